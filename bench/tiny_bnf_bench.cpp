@@ -0,0 +1,342 @@
+// Measures tokenize, parse and generate on the calc and lang examples:
+//
+//   tiny_bnf_bench [--json] [--filter text] [--max-tokens n]
+//
+// calc runs on synthetic expressions of 10 to 100k tokens, up to 10k for
+// Earley and GLR, and lang on all the sentences of its corpus, so it must run
+// from the root of the repository.
+// Each case reports latency percentiles per input, throughput, and the heap
+// allocations and peak heap of one pass over its inputs. With --json, each
+// case is printed as a JSON object on a line of its own, for comparing runs.
+// Inputs are generated from fixed seeds, so runs measure the same work
+#include "../examples/calc/calc.h"
+#include "../examples/lang/lang.h"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdlib>
+#include <functional>
+#include <new>
+#include <random>
+
+#if __has_include(<pthread.h>)
+#include <pthread.h>
+#define TINY_BNF_PTHREAD 1
+#endif
+
+namespace {
+
+// Heap usage of the program, counted by the replaced operator new below
+struct Heap {
+  std::atomic<size_t> allocations = 0;
+  std::atomic<size_t> bytes = 0;
+  std::atomic<size_t> live = 0;
+  std::atomic<size_t> peak = 0;
+};
+
+Heap heap;
+
+// Allocations carry their size and the offset of the block in front of them
+auto allocate(size_t n, size_t alignment) -> void* {
+  auto header = std::max(alignof(std::max_align_t), alignment);
+  auto* block = alignment > alignof(std::max_align_t)
+                    ? std::aligned_alloc(alignment, (header + n + alignment -
+                                                     1) / alignment * alignment)
+                    : std::malloc(header + n);
+  if (!block) return nullptr;
+
+  auto* p = static_cast<char*>(block) + header;
+  reinterpret_cast<size_t*>(p)[-1] = n;
+  reinterpret_cast<size_t*>(p)[-2] = header;
+  heap.allocations += 1;
+  heap.bytes += n;
+  auto live = heap.live += n;
+  for (auto peak = heap.peak.load();
+       live > peak && !heap.peak.compare_exchange_weak(peak, live);) {
+  }
+  return p;
+}
+
+void deallocate(void* p) {
+  if (!p) return;
+  heap.live -= reinterpret_cast<size_t*>(p)[-1];
+  std::free(static_cast<char*>(p) - reinterpret_cast<size_t*>(p)[-2]);
+}
+
+auto allocateOrThrow(size_t n, size_t alignment) -> void* {
+  if (auto* p = allocate(n, alignment)) return p;
+  throw std::bad_alloc();
+}
+
+}  // namespace
+
+void* operator new(size_t n) {
+  return allocateOrThrow(n, alignof(std::max_align_t));
+}
+void* operator new[](size_t n) {
+  return allocateOrThrow(n, alignof(std::max_align_t));
+}
+void* operator new(size_t n, std::align_val_t a) {
+  return allocateOrThrow(n, size_t(a));
+}
+void* operator new[](size_t n, std::align_val_t a) {
+  return allocateOrThrow(n, size_t(a));
+}
+void* operator new(size_t n, const std::nothrow_t&) noexcept {
+  return allocate(n, alignof(std::max_align_t));
+}
+void* operator new[](size_t n, const std::nothrow_t&) noexcept {
+  return allocate(n, alignof(std::max_align_t));
+}
+void operator delete(void* p) noexcept { deallocate(p); }
+void operator delete[](void* p) noexcept { deallocate(p); }
+void operator delete(void* p, size_t) noexcept { deallocate(p); }
+void operator delete[](void* p, size_t) noexcept { deallocate(p); }
+void operator delete(void* p, std::align_val_t) noexcept { deallocate(p); }
+void operator delete[](void* p, std::align_val_t) noexcept { deallocate(p); }
+void operator delete(void* p, size_t, std::align_val_t) noexcept {
+  deallocate(p);
+}
+void operator delete[](void* p, size_t, std::align_val_t) noexcept {
+  deallocate(p);
+}
+
+namespace {
+
+struct Options {
+  bool json = false;
+  std::string filter;
+  size_t maxTokens = 100000;
+};
+
+struct Result {
+  std::string name;
+  std::string input;
+  size_t inputs = 0;
+  size_t tokens = 0;
+  size_t runs = 0;
+  double p50 = 0, p90 = 0, p99 = 0;
+  double tokensPerSecond = 0;
+  size_t allocations = 0;
+  size_t allocatedBytes = 0;
+  size_t peakBytes = 0;
+};
+
+// Runs `run` on each of `n` inputs, `tokens` tokens in all, in passes until
+// at least 5 passes and a quarter of a second are done
+auto measure(const std::string& name, const std::string& input, size_t n,
+             size_t tokens, const std::function<void(size_t)>& run)
+    -> Result {
+  using Clock = std::chrono::steady_clock;
+  Result result{name, input, n, tokens};
+
+  for (size_t i = 0; i != n; ++i) run(i);
+
+  // the latencies of a pass are kept apart, so that the pass allocates
+  // nothing but what `run` does
+  std::vector<double> latencies, pass(n);
+  double total = 0;
+  for (size_t p = 0; p < 5 || (total < 0.25 && p < 10000); ++p) {
+    size_t allocations = heap.allocations, bytes = heap.bytes;
+    size_t live = heap.live;
+    heap.peak = live;
+    for (size_t i = 0; i != n; ++i) {
+      auto start = Clock::now();
+      run(i);
+      pass[i] = std::chrono::duration<double>(Clock::now() - start).count();
+    }
+    result.allocations = heap.allocations - allocations;
+    result.allocatedBytes = heap.bytes - bytes;
+    result.peakBytes = std::max(result.peakBytes, heap.peak - live);
+    result.runs += n;
+    for (auto seconds : pass) total += seconds;
+    latencies.insert(end(latencies), begin(pass), end(pass));
+  }
+
+  std::sort(begin(latencies), end(latencies));
+  auto percentile = [&](size_t p) {
+    return latencies[(size(latencies) - 1) * p / 100] * 1e6;
+  };
+  result.p50 = percentile(50);
+  result.p90 = percentile(90);
+  result.p99 = percentile(99);
+  result.tokensPerSecond = tokens * (result.runs / n) / total;
+  return result;
+}
+
+void print(const Result& r, const Options& options) {
+  if (options.json) {
+    std::cout << "{\"name\": \"" << r.name << "\", \"input\": \"" << r.input
+              << "\", \"inputs\": " << r.inputs << ", \"tokens\": "
+              << r.tokens << ", \"runs\": " << r.runs
+              << ", \"p50_us\": " << r.p50 << ", \"p90_us\": " << r.p90
+              << ", \"p99_us\": " << r.p99
+              << ", \"tokens_per_s\": " << r.tokensPerSecond
+              << ", \"allocations\": " << r.allocations
+              << ", \"allocated_bytes\": " << r.allocatedBytes
+              << ", \"peak_bytes\": " << r.peakBytes << "}\n";
+    return;
+  }
+
+  char line[256];
+  std::snprintf(line, sizeof line,
+                "%-22s %-7s %8zu %6zu %10.1f %10.1f %10.1f %9.3f %9zu %9.3f "
+                "%9.3f\n",
+                r.name.c_str(), r.input.c_str(), r.tokens, r.runs, r.p50,
+                r.p90, r.p99, r.tokensPerSecond / 1e6, r.allocations,
+                r.allocatedBytes / 1e6, r.peakBytes / 1e6);
+  std::cout << line;
+}
+
+// Expression of at least `n` tokens with numbers, the four operators and
+// nested parentheses, the same for each n
+auto calcInput(size_t n) -> std::string {
+  std::mt19937 rng(n);
+  std::string s;
+  size_t tokens = 0, depth = 0;
+  auto digits = [&] {
+    for (auto d = 1 + rng() % 3; d--; ++tokens) s += char('0' + rng() % 10);
+  };
+
+  for (;;) {
+    for (; depth < 8 && rng() % 8 == 0; ++depth, ++tokens) s += '(';
+    digits();
+    if (rng() % 4 == 0) {
+      s += '.';
+      ++tokens;
+      digits();
+    }
+    for (; depth && rng() % 4 == 0; --depth, ++tokens) s += ')';
+    if (tokens >= n) break;
+    s += rng() % 2 ? " " : "";
+    s += "+-*/"[rng() % 4];
+    s += rng() % 2 ? " " : "";
+    ++tokens;
+  }
+  s.append(depth, ')');
+  return s;
+}
+
+void benchCalc(const Options& options, std::vector<Result>& results) {
+  auto parser = buildParser();
+  const auto& [terminals, grammar, generator] = parser;
+
+  for (size_t n = 10; n <= options.maxTokens; n *= 10) {
+    auto text = calcInput(n);
+    auto tokens = *tiny_bnf::tokenize(terminals, grammar, text);
+    auto input = std::to_string(n);
+    auto add = [&](const std::string& name, std::function<void(size_t)> f) {
+      if (name.find(options.filter) == std::string::npos) return;
+      results.push_back(measure(name, input, 1, size(tokens), f));
+      print(results.back(), options);
+    };
+
+    add("calc/tokenize", [&](size_t) {
+      auto result = tiny_bnf::tokenize(terminals, grammar, text);
+      if (!result) std::abort();
+    });
+
+    // Earley and GLR take time and memory quadratic in the depth of the
+    // right recursion of calc, which makes 100k tokens take minutes
+    struct Engine {
+      const char* name;
+      tiny_bnf::ParserType type;
+      size_t maxTokens;
+    };
+    Engine engines[] = {{"earley", tiny_bnf::Earley, 10000},
+                        {"glr", tiny_bnf::GLR, 10000},
+                        {"ll1", tiny_bnf::LL1, options.maxTokens}};
+    for (auto engine : engines)
+      if (n <= engine.maxTokens)
+        add(std::string("calc/parse/") + engine.name, [&](size_t) {
+          auto trees = tiny_bnf::parse(grammar, tokens, engine.type);
+          if (!trees) std::abort();
+        });
+
+    auto trees = *tiny_bnf::parse(grammar, tokens);
+    add("calc/generate", [&](size_t) {
+      auto stmt = tiny_bnf::generate<Stmt>(generator, trees[0]);
+      if (!stmt) std::abort();
+    });
+  }
+}
+
+void benchLang(const Options& options, std::vector<Result>& results) {
+  auto [terminals, grammar] = load("");
+  auto lines = readSentences(grammar, true);
+
+  std::vector<tiny_bnf::TokenStream> inputs;
+  size_t tokens = 0;
+  for (const auto& line : lines) {
+    auto input = tiny_bnf::tokenize(terminals, grammar, line, true);
+    inputs.push_back(input ? *input : tiny_bnf::TokenStream{});
+    tokens += size(inputs.back());
+  }
+
+  auto add = [&](const std::string& name, std::function<void(size_t)> f) {
+    if (name.find(options.filter) == std::string::npos) return;
+    results.push_back(measure(name, "corpus", size(lines), tokens, f));
+    print(results.back(), options);
+  };
+
+  add("lang/tokenize", [&](size_t i) {
+    tiny_bnf::tokenize(terminals, grammar, lines[i], true);
+  });
+  add("lang/parse/earley", [&](size_t i) {
+    tiny_bnf::parse(grammar, inputs[i], tiny_bnf::Earley);
+  });
+}
+
+// Runs `f` on a thread with a stack large enough for the recursion over the
+// deep trees of the largest inputs
+void runOnLargeStack(std::function<void()> f) {
+#ifdef TINY_BNF_PTHREAD
+  pthread_attr_t attributes;
+  pthread_attr_init(&attributes);
+  pthread_attr_setstacksize(&attributes, size_t(1) << 30);
+  pthread_t thread;
+  auto start = [](void* f) -> void* {
+    (*static_cast<std::function<void()>*>(f))();
+    return nullptr;
+  };
+  if (pthread_create(&thread, &attributes, start, &f) == 0) {
+    pthread_join(thread, nullptr);
+    pthread_attr_destroy(&attributes);
+    return;
+  }
+  pthread_attr_destroy(&attributes);
+#endif
+  f();
+}
+
+}  // namespace
+
+int main(int argc, char** argv) {
+  Options options;
+  for (int i = 1; i < argc; ++i) {
+    std::string arg = argv[i];
+    if (arg == "--json") {
+      options.json = true;
+    } else if (arg == "--filter" && i + 1 < argc) {
+      options.filter = argv[++i];
+    } else if (arg == "--max-tokens" && i + 1 < argc) {
+      options.maxTokens = std::stoul(argv[++i]);
+    } else {
+      std::cerr << "usage: tiny_bnf_bench [--json] [--filter text] "
+                   "[--max-tokens n]\n";
+      return 2;
+    }
+  }
+
+  if (!options.json)
+    std::cout << "case                   input     tokens   runs    p50 us "
+                 "    p90 us     p99 us   Mtok/s    allocs  alloc MB   "
+                 "peak MB\n";
+
+  std::vector<Result> results;
+  runOnLargeStack([&] {
+    benchCalc(options, results);
+    benchLang(options, results);
+  });
+}
@@ -145,8 +145,8 @@ struct Stmt {
   Expr expr;
 };
 
-auto buildParser() {
-  tiny_bnf::Specification spec;
+constexpr auto calcSpecification() {
+  tiny_bnf::StaticSpecification<32, 32, 64> spec;
   using tiny_bnf::opt;
 
   spec["stmt"] >= "expr";
@@ -168,8 +168,17 @@ auto buildParser() {
 
   spec["digit"] >= "0" | "1" | "2" | "3" | "4" | "5" | "6" | "7" | "8" | "9";
 
+  return spec;
+}
+
+// the grammar is compiled along with the program
+constexpr auto calcGrammar = tiny_bnf::compile(calcSpecification());
+
+auto buildParser() {
+  auto grammar = calcGrammar.compiled();
+
   //
-  tiny_bnf::Terminals terminals = autoTerminals(spec);
+  tiny_bnf::Terminals terminals = autoTerminals(grammar);
   terminals[" "] = "";
 
   //
@@ -206,20 +215,22 @@ auto buildParser() {
   gen.bind<RightParenthesis>(")");
   gen.bind<Dot>(".");
 
-  return std::make_tuple(terminals, spec, std::move(gen));
+  auto generator = tiny_bnf::compile(gen, grammar);
+  return std::make_tuple(tiny_bnf::compile(terminals), std::move(grammar),
+                         std::move(generator));
 }
 
 tiny_bnf::Expected<float> eval(
     std::string input,
-    const std::tuple<tiny_bnf::Terminals, tiny_bnf::Specification,
-                     tiny_bnf::Generator>& parser) {
-  auto& [terminals, spec, gen] = parser;
+    const std::tuple<tiny_bnf::CompiledTerminals, tiny_bnf::CompiledGrammar,
+                     tiny_bnf::CompiledGenerator>& parser) {
+  auto& [terminals, grammar, gen] = parser;
 
-  auto tokens = tiny_bnf::tokenize(terminals, input);
+  auto tokens = tiny_bnf::tokenize(terminals, grammar, input);
   if (!tokens)
     return tiny_bnf::Error<>("Failed to tokenize: " + tokens.error());
 
-  auto tree = tiny_bnf::parse(spec, *tokens, tiny_bnf::ParserType::Earley);
+  auto tree = tiny_bnf::parse(grammar, *tokens);
 
   if (!tree) return tiny_bnf::Error<>("Failed to parse: " + tree.error());
 
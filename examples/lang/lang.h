@@ -0,0 +1,147 @@
+#include <tiny_bnf.h>
+
+#include <cstdlib>
+#include <fstream>
+#include <iostream>
+#include <set>
+#include <sstream>
+
+namespace bnf = tiny_bnf;
+
+auto readFile(std::string filename) -> std::string {
+  std::ifstream file(filename);
+  if (!file.is_open()) std::cout << "cannot open: " << filename << '\n';
+  file.seekg(0, file.end);
+  std::string str;
+  str.resize(file.tellg());
+  file.seekg(file.beg);
+  file.read(&str[0], size(str));
+  return str;
+}
+
+auto split(std::string line) {
+  std::vector<std::string> words;
+  std::stringstream ss(line);
+  std::string word;
+  while (ss >> word) words.push_back(word);
+  return words;
+}
+
+std::string dir = "examples/lang/";
+
+void importWords(bnf::Specification& spec) {
+  auto import = [&](auto filename) {
+    std::string type;
+    bnf::forEachLine(readFile(dir + filename), [&](auto w) {
+      if (auto p = w.find_first_of(' '); p != w.npos) w = w.substr(0, p);
+      if (w[0] == '#')
+        type = w.substr(1);
+      else
+        spec[type] >= w;
+    });
+  };
+
+  import("noun.txt");
+  import("adj.txt");
+  import("adv.txt");
+  import("p.txt");
+
+  bnf::forEachLine(readFile(dir + "verb.txt"), [&](auto w) {
+    auto words = split(w.substr(0, w.find('/')));
+    auto tags = split(w.substr(w.find('/') + 1));
+    for (auto tag : tags) {
+      if (size(words) == 8) {
+        spec["VB~" + tag] >= words[0];
+        spec["VBP~" + tag] >= words[1];
+        spec["VBP~" + tag] >= words[2];
+        spec["VBP~" + tag] >= words[3];
+        spec["VBD~" + tag] >= words[4];
+        spec["VBD~" + tag] >= words[5];
+        spec["VVN~" + tag] >= words[6];
+        spec["VAG~" + tag] >= words[7];
+      } else {
+        spec["VB~" + tag] >= words[0];
+        spec["VBP~" + tag] >= words[0];
+        spec["VBP~" + tag] >= words[1];
+        spec["VBD~" + tag] >= words[2];
+        spec["VVN~" + tag] >= words[3];
+        spec["VAG~" + tag] >= words[4];
+      }
+    }
+  });
+}
+
+// Builds the tokenizer and the grammar from the grammar and the lexicon, or
+// loads them from `cache` if it was written by an earlier run
+auto load(const std::string& cache)
+    -> std::pair<bnf::CompiledTerminals, bnf::CompiledGrammar> {
+  if (!cache.empty())
+    if (auto loaded = bnf::loadCompiled(cache)) return std::move(*loaded);
+
+  auto spec = bnf::parseSpec(readFile(dir + "grammar.txt"));
+  if (!spec) {
+    std::cout << "grammar.txt:" << spec.error() << '\n';
+    std::exit(1);
+  }
+  importWords(*spec);
+
+  auto terminals = bnf::autoTerminals(*spec);
+  terminals[" "] = "";
+  terminals["-"] = "-";
+
+  auto compiled = std::pair{bnf::compile(terminals), bnf::compile(*spec)};
+  if (!cache.empty()) {
+    auto saved = bnf::saveCompiled(cache, compiled.first, compiled.second);
+    if (!saved) std::cout << saved.error() << '\n';
+  }
+  return compiled;
+}
+
+// the words of the lexicon that keep their case
+auto properNouns(const bnf::CompiledGrammar& grammar) {
+  std::set<std::string> nouns = {"I"};
+  for (const auto& rule : grammar.rules) {
+    const auto& symbol = grammar.symbols[rule.symbol];
+    if ((symbol == "NPR" || symbol == "NPRS") && grammar.size(rule) == 1)
+      nouns.insert(grammar.symbols[grammar.exprs[rule.exprBegin].symbol]);
+  }
+  return nouns;
+}
+
+// The sentences to parse, lowercased except for proper nouns. Only those
+// marked with a leading '+', if there are any and `all` is not set
+auto readSentences(const bnf::CompiledGrammar& grammar, bool all = false)
+    -> std::vector<std::string> {
+  auto properNouns = ::properNouns(grammar);
+
+  bool selected = false;
+  bnf::forEachLine(readFile(dir + "sentences.txt"), [&](auto line) {
+    if (line[0] == '+') selected = !all;
+  });
+
+  std::vector<std::string> lines;
+  bnf::forEachLine(readFile(dir + "sentences.txt"), [&](auto line) {
+    if (line[0] != '#' && (!selected || line[0] == '+')) {
+      if (line[0] == '+') line = line.substr(1);
+      std::stringstream ss(line);
+      std::string word;
+      line.clear();
+      while (ss >> word) {
+        bool trailingComma = false;
+        if (word.back() == ',') {
+          trailingComma = true;
+          word = word.substr(0, size(word) - 1);
+        }
+        if (properNouns.find(word) == end(properNouns))
+          for (auto& l : word)
+            if (std::isalpha(l)) l = std::tolower(l);
+        if (trailingComma) word += ",";
+        line += word + " ";
+      }
+      line.pop_back();
+      lines.push_back(line);
+    }
+  });
+
+  return lines;
+}
@@ -1,12 +1,11 @@
-#include <tiny_bnf.h>
+#include "lang.h"
 
 #include <chrono>
+#include <cstdlib>
 #include <fstream>
 #include <iostream>
 #include <set>
 
-namespace bnf = tiny_bnf;
-
 void printTree(const bnf::Node& node, bool isRoot = true) {
   if (!isRoot) {
     size_t p = node.symbol.find_first_of('.');
@@ -34,150 +33,81 @@ void printTree(const bnf::Node& node, bool isRoot = true) {
   }
 }
 
-int parse(std::string text, const bnf::Terminals& terminals,
-          const bnf::Specification& spec) {
+int print(const std::string& text,
+          const bnf::Expected<bnf::TokenStream>& tokens,
+          bnf::Expected<std::vector<bnf::Node>>& trees) {
   std::cout << text << '\n';
-  if (auto tokens = bnf::tokenize(terminals, text, true))
-    if (auto trees = bnf::parse(spec, *tokens)) {
-      std::vector<size_t> shallowest;
-      float depth = 1e+20f;
-      for (size_t i = 0; i < size(*trees); ++i) {
-        float d = 0;
-        bnf::traverse((*trees)[i],
-                      [&](auto&, float z, float w) { d += z + w * 0.001f; });
-        if (d < depth) {
-          shallowest.clear();
-          depth = d;
-        }
-        if (d == depth) shallowest.push_back(i);
-      }
-      for (auto i : shallowest) {
-        printTree((*trees)[i]);
-        std::cout << '\n';
-      }
-    } else {
-      std::cout << "parser error: " << trees.error() << "\n\n";
-      return 1;
-    }
-  else {
+  if (!tokens) {
     std::cout << "tokenizer error: " << tokens.error() << "\n\n";
     return 1;
   }
+  if (!trees) {
+    std::cout << "parser error: " << trees.error() << "\n\n";
+    return 1;
+  }
+
+  std::vector<size_t> shallowest;
+  float depth = 1e+20f;
+  for (size_t i = 0; i < size(*trees); ++i) {
+    float d = 0;
+    bnf::traverse((*trees)[i],
+                  [&](auto&, float z, float w) { d += z + w * 0.001f; });
+    if (d < depth) {
+      shallowest.clear();
+      depth = d;
+    }
+    if (d == depth) shallowest.push_back(i);
+  }
+  for (auto i : shallowest) {
+    printTree((*trees)[i]);
+    std::cout << '\n';
+  }
 
   std::cout << '\n';
   return 0;
 }
 
-auto readFile(std::string filename) -> std::string {
-  std::ifstream file(filename);
-  if (!file.is_open()) std::cout << "cannot open: " << filename << '\n';
-  file.seekg(0, file.end);
-  std::string str;
-  str.resize(file.tellg());
-  file.seekg(file.beg);
-  file.read(&str[0], size(str));
-  return str;
-}
-
-auto split(std::string line) {
-  std::vector<std::string> words;
-  std::stringstream ss(line);
-  std::string word;
-  while (ss >> word) words.push_back(word);
-  return words;
-}
-
-std::string dir = "examples/lang/";
+// The sentences are parsed with the grammar cached in the file given as the
+// first argument, if any. With --profile, the rules that the parses spend the
+// most on, by items, completions or seconds, are printed instead of the trees
+int main(int argc, char** argv) {
+  std::string cache, profile;
+  for (int i = 1; i < argc; ++i) {
+    std::string arg = argv[i];
+    if (arg == "--profile" && i + 1 < argc)
+      profile = argv[++i];
+    else
+      cache = arg;
+  }
+  auto [tokenizer, grammar] = load(cache);
 
-auto importWords(bnf::Specification& spec) {
-  std::set<std::string> properNouns = {"I"};
+  auto lines = readSentences(grammar);
 
-  auto import = [&](auto filename) {
-    std::string type;
-    bnf::forEachLine(readFile(dir + filename), [&](auto w) {
-      if (auto p = w.find_first_of(' '); p != w.npos) w = w.substr(0, p);
-      if (w[0] == '#')
-        type = w.substr(1);
-      else {
-        spec[type] >= w;
-        if (type == "NPR" || type == "NPRS") properNouns.insert(w);
-      }
-    });
-  };
-
-  import("noun.txt");
-  import("adj.txt");
-  import("adv.txt");
-  import("p.txt");
-
-  bnf::forEachLine(readFile(dir + "verb.txt"), [&](auto w) {
-    auto words = split(w.substr(0, w.find('/')));
-    auto tags = split(w.substr(w.find('/') + 1));
-    for (auto tag : tags) {
-      if (size(words) == 8) {
-        spec["VB~" + tag] >= words[0];
-        spec["VBP~" + tag] >= words[1];
-        spec["VBP~" + tag] >= words[2];
-        spec["VBP~" + tag] >= words[3];
-        spec["VBD~" + tag] >= words[4];
-        spec["VBD~" + tag] >= words[5];
-        spec["VVN~" + tag] >= words[6];
-        spec["VAG~" + tag] >= words[7];
-      } else {
-        spec["VB~" + tag] >= words[0];
-        spec["VBP~" + tag] >= words[0];
-        spec["VBP~" + tag] >= words[1];
-        spec["VBD~" + tag] >= words[2];
-        spec["VVN~" + tag] >= words[3];
-        spec["VAG~" + tag] >= words[4];
-      }
-    }
-  });
-
-  return properNouns;
-}
+  // the tokens refer to the lines, which do not move from here on
+  std::vector<bnf::Expected<bnf::TokenStream>> tokens;
+  std::vector<bnf::TokenStream> inputs;
+  for (const auto& line : lines) {
+    tokens.push_back(bnf::tokenize(tokenizer, grammar, line, true));
+    inputs.push_back(tokens.back() ? *tokens.back() : bnf::TokenStream{});
+  }
 
-int main() {
-  auto spec = bnf::parseSpec(readFile(dir + "grammar.txt"));
-  auto properNouns = importWords(spec);
+  if (!profile.empty()) {
+    auto order = profile == "items"         ? bnf::RuleProfiler::Items
+                 : profile == "completions" ? bnf::RuleProfiler::Completions
+                                            : bnf::RuleProfiler::Seconds;
+    bnf::RuleProfiler profiler(grammar);
+    bnf::BatchOptions options;
+    options.parse.observer = &profiler;
+    bnf::parseBatch(grammar, inputs, options);
+    profiler.print(std::cout, order, 40);
+    return 0;
+  }
 
-  auto terminals = bnf::autoTerminals(spec);
-  terminals[" "] = "";
-  terminals["-"] = "-";
+  auto trees = bnf::parseBatch(grammar, inputs);
 
   int ret = 0;
-
-  bool selected = false;
-  bnf::forEachLine(readFile(dir + "sentences.txt"), [&](auto line) {
-    if (line[0] == '+') selected = true;
-  });
-
-  bnf::forEachLine(readFile(dir + "sentences.txt"), [&](auto line) {
-    // auto t0 = std::chrono::high_resolution_clock::now();
-    if (line[0] != '#' && (!selected || line[0] == '+')) {
-      if (line[0] == '+') line = line.substr(1);
-      std::stringstream ss(line);
-      std::string word;
-      line.clear();
-      while (ss >> word) {
-        bool trailingComma = false;
-        if (word.back() == ',') {
-          trailingComma = true;
-          word = word.substr(0, size(word) - 1);
-        }
-        if (properNouns.find(word) == end(properNouns))
-          for (auto& l : word)
-            if (std::isalpha(l)) l = std::tolower(l);
-        if (trailingComma) word += ",";
-        line += word + " ";
-      }
-      line.pop_back();
-
-      ret += parse(line, terminals, spec);
-    }
-    // auto t1 = std::chrono::high_resolution_clock::now();
-    // std::cout << std::chrono::duration<float>(t1 - t0).count() << "\n";
-  });
+  for (size_t i = 0; i != size(lines); ++i)
+    ret += print(lines[i], tokens[i], trees[i]);
 
   if (ret) {
     std::cout << "\n" << ret << " sentences failed to be parsed\n";
@@ -0,0 +1,28 @@
+#include <number_grammar.h>
+
+#include <iostream>
+
+struct Digit {
+  Digit(std::string str) : val(std::stoi(str)) {}
+  int val;
+};
+
+struct Number {
+  Number(Digit d) : val(d.val) {}
+  Number(Number n, Digit d) : val(n.val * 10 + d.val) {}
+  int val;
+};
+
+int main() {
+  namespace bnf = tiny_bnf;
+
+  // the grammar of examples/minimal.txt is compiled into the program
+  auto tree = number_grammar::parse("31415926");
+
+  auto gen = bnf::Generator();
+  gen.bind<Digit>("digit", bnf::UseString{});
+  gen.bind<Number>("number", bnf::Ctor<Digit>{}, bnf::Ctor<Number, Digit>{});
+  auto number = bnf::generate<Number>(gen, (*tree)[0]);
+
+  std::cout << number->val << "\n";
+}
@@ -0,0 +1,129 @@
+#include <tiny_bnf_internal.h>
+
+#include <algorithm>
+#include <mutex>
+#include <optional>
+#include <thread>
+
+namespace tiny_bnf {
+
+namespace {
+
+// Range of the inputs a worker has yet to parse. Its owner takes them from
+// the front, and workers that ran out of their own steal them from the back
+struct WorkQueue {
+  auto pop() -> std::optional<size_t> {
+    std::lock_guard lock(mutex);
+    if (first == last) return std::nullopt;
+    return first++;
+  }
+
+  auto steal() -> std::optional<size_t> {
+    std::lock_guard lock(mutex);
+    if (first == last) return std::nullopt;
+    return --last;
+  }
+
+  std::mutex mutex;
+  size_t first = 0;
+  size_t last = 0;
+};
+
+template <typename Input>
+auto parseAll(const CompiledGrammar &grammar, const std::vector<Input> &inputs,
+              const BatchOptions &options)
+    -> std::vector<Expected<std::vector<Node>>> {
+  auto n = size(inputs);
+  std::vector<Expected<std::vector<Node>>> results(n, Error<>());
+  if (n == 0) return results;
+
+  size_t threads = options.threads ? options.threads
+                                   : std::thread::hardware_concurrency();
+  threads = std::clamp<size_t>(threads, 1, n);
+
+  std::vector<WorkQueue> queues(threads);
+  for (size_t w = 0; w != threads; ++w) {
+    queues[w].first = n * w / threads;
+    queues[w].last = n * (w + 1) / threads;
+  }
+
+  auto work = [&](size_t w) {
+    auto run = [&](size_t i) {
+      results[i] = parse(grammar, inputs[i], options.parserType, options.parse);
+    };
+    while (auto i = queues[w].pop()) run(*i);
+    for (size_t v = 1; v != threads; ++v)
+      while (auto i = queues[(w + v) % threads].steal()) run(*i);
+  };
+
+  std::vector<std::thread> pool;
+  for (size_t w = 1; w != threads; ++w) pool.emplace_back(work, w);
+  work(0);
+  for (auto &thread : pool) thread.join();
+
+  return results;
+}
+
+}  // namespace
+
+WorkerPool::WorkerPool(size_t threads) {
+  for (size_t t = 1; t < threads; ++t)
+    workers.emplace_back([this] {
+      for (size_t seen = 0;;) {
+        {
+          std::unique_lock lock(mutex);
+          wake.wait(lock, [&] { return stop || generation != seen; });
+          if (stop) return;
+          seen = generation;
+        }
+        work();
+        std::lock_guard lock(mutex);
+        if (--busy == 0) done.notify_one();
+      }
+    });
+}
+
+WorkerPool::~WorkerPool() {
+  {
+    std::lock_guard lock(mutex);
+    stop = true;
+  }
+  wake.notify_all();
+  for (auto &worker : workers) worker.join();
+}
+
+void WorkerPool::run(size_t n, const std::function<void(size_t)> &f) {
+  {
+    std::lock_guard lock(mutex);
+    job = &f;
+    this->n = n;
+    next = 0;
+    busy = size(workers);
+    ++generation;
+  }
+  wake.notify_all();
+  work();
+
+  std::unique_lock lock(mutex);
+  done.wait(lock, [&] { return busy == 0; });
+}
+
+void WorkerPool::work() {
+  constexpr size_t chunk = 64;
+  for (size_t i; (i = next.fetch_add(chunk)) < n;)
+    for (auto j = i; j != std::min(i + chunk, n); ++j) (*job)(j);
+}
+
+auto parseBatch(const CompiledGrammar &grammar,
+                const std::vector<TokenStream> &inputs, BatchOptions options)
+    -> std::vector<Expected<std::vector<Node>>> {
+  return parseAll(grammar, inputs, options);
+}
+
+auto parseBatch(const CompiledGrammar &grammar,
+                const std::vector<Tokens> &inputs, BatchOptions options)
+    -> std::vector<Expected<std::vector<Node>>> {
+  return parseAll(grammar, inputs, options);
+}
+
+}  // namespace tiny_bnf
@@ -0,0 +1,244 @@
+#include <tiny_bnf_internal.h>
+
+#include <cstring>
+#include <fstream>
+#include <type_traits>
+
+#if __has_include(<sys/mman.h>)
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#define TINY_BNF_MMAP 1
+#endif
+
+namespace tiny_bnf {
+
+namespace {
+
+// Layout of a cache file: the header, then each array of the terminals and
+// the grammar as its length followed by its elements, as they are in memory.
+// Arrays start at multiples of 8 bytes, so they can be copied out of the
+// mapped file as they are
+struct Header {
+  char magic[8] = {'t', 'i', 'n', 'y', 'b', 'n', 'f', '\0'};
+  // bump whenever the layout of the file or of the arrays changes
+  uint32_t version = 1;
+  uint32_t byteOrder = 0x01020304;
+  uint32_t ruleSize = sizeof(CompiledGrammar::Rule);
+  uint32_t exprSize = sizeof(CompiledGrammar::Expr);
+  uint32_t wordSize = sizeof(size_t);
+  uint32_t reserved = 0;
+
+  auto operator==(const Header &rhs) const {
+    return std::memcmp(this, &rhs, sizeof(Header)) == 0;
+  }
+};
+
+struct Writer {
+  template <typename T>
+  void scalar(T value) {
+    bytes.append((const char *)&value, sizeof(T));
+  }
+
+  template <typename T>
+  void array(const T *data, size_t n) {
+    static_assert(std::is_trivially_copyable_v<T>);
+    scalar(uint64_t(n));
+    bytes.append((const char *)data, n * sizeof(T));
+    bytes.resize((size(bytes) + 7) / 8 * 8);
+  }
+
+  template <typename T>
+  void array(const std::vector<T> &v) {
+    array(v.data(), size(v));
+  }
+
+  // offsets of the strings into their concatenation, then the concatenation
+  void strings(const std::vector<std::string> &v) {
+    std::vector<uint64_t> offsets = {0};
+    std::string text;
+    for (const auto &s : v) {
+      text += s;
+      offsets.push_back(size(text));
+    }
+    array(offsets);
+    array(text.data(), size(text));
+  }
+
+  std::string bytes;
+};
+
+struct Reader {
+  template <typename T>
+  auto scalar(T &value) -> bool {
+    if (size_t(end - p) < sizeof(T)) return false;
+    std::memcpy(&value, p, sizeof(T));
+    p += sizeof(T);
+    return true;
+  }
+
+  // the elements of the next array, which stay in the file
+  template <typename T>
+  auto view(const T *&data, size_t &n) -> bool {
+    uint64_t count = 0;
+    if (!scalar(count) || count > size_t(end - p) / sizeof(T)) return false;
+    data = (const T *)p;
+    n = count;
+    p += (count * sizeof(T) + 7) / 8 * 8;
+    return p <= end;
+  }
+
+  template <typename T>
+  auto array(std::vector<T> &v) -> bool {
+    const T *data = nullptr;
+    size_t n = 0;
+    if (!view(data, n)) return false;
+    v.assign(data, data + n);
+    return true;
+  }
+
+  auto strings(std::vector<std::string> &v) -> bool {
+    const uint64_t *offsets = nullptr;
+    const char *text = nullptr;
+    size_t n = 0, length = 0;
+    if (!view(offsets, n) || !view(text, length) || n == 0) return false;
+    v.clear();
+    v.reserve(n - 1);
+    for (size_t i = 0; i + 1 != n; ++i) {
+      if (offsets[i] > offsets[i + 1] || offsets[i + 1] > length) return false;
+      v.emplace_back(text + offsets[i], text + offsets[i + 1]);
+    }
+    return true;
+  }
+
+  const char *p, *end;
+};
+
+// The contents of a file, mapped into memory where the system allows it
+struct FileView {
+  explicit FileView(const std::string &filename) {
+#ifdef TINY_BNF_MMAP
+    auto fd = ::open(filename.c_str(), O_RDONLY);
+    if (fd == -1) return;
+    struct stat st;
+    if (::fstat(fd, &st) == 0 && st.st_size > 0) {
+      auto p = ::mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+      if (p != MAP_FAILED) {
+        data = (const char *)p;
+        length = st.st_size;
+      }
+    }
+    ::close(fd);
+    if (data) return;
+#endif
+    std::ifstream file(filename, std::ios::binary);
+    if (!file) return;
+    fallback.assign(std::istreambuf_iterator<char>(file), {});
+    data = fallback.data();
+    length = size(fallback);
+  }
+
+  ~FileView() {
+#ifdef TINY_BNF_MMAP
+    if (data && fallback.empty()) ::munmap((void *)data, length);
+#endif
+  }
+
+  FileView(const FileView &) = delete;
+  auto operator=(const FileView &) -> FileView & = delete;
+
+  const char *data = nullptr;
+  size_t length = 0;
+  std::string fallback;
+};
+
+}  // namespace
+
+auto saveCompiled(const std::string &filename,
+                  const CompiledTerminals &terminals,
+                  const CompiledGrammar &grammar) -> Expected<size_t> {
+  Writer w;
+  w.scalar(Header{});
+
+  w.array(terminals.classes.data(), size(terminals.classes));
+  w.scalar(uint64_t(terminals.nClasses));
+  w.array(terminals.transitions);
+  w.array(terminals.accepts);
+  w.strings(terminals.symbols);
+  w.array(terminals.skip.data(), size(terminals.skip));
+
+  w.strings(grammar.symbols);
+  w.array(grammar.rules);
+  w.array(grammar.exprs);
+  w.array(grammar.alternatives);
+  w.array(grammar.alternativesBegin);
+  w.array(grammar.attribs);
+  w.strings(grammar.attributes);
+  std::vector<int> merges;
+  for (auto [attribute, merged] : grammar.merges) {
+    merges.push_back(attribute);
+    merges.push_back(merged);
+  }
+  w.array(merges);
+  w.array(grammar.mergesBegin);
+  w.array(grammar.first);
+  w.scalar(uint64_t(grammar.firstWords));
+  std::vector<uint8_t> nullable(begin(grammar.nullable),
+                                end(grammar.nullable));
+  w.array(nullable);
+  w.scalar(int64_t(grammar.start));
+
+  std::ofstream file(filename, std::ios::binary | std::ios::trunc);
+  if (!file.write(w.bytes.data(), size(w.bytes)))
+    return Error<>("cannot write: " + filename);
+  return size(w.bytes);
+}
+
+auto loadCompiled(const std::string &filename)
+    -> Expected<std::pair<CompiledTerminals, CompiledGrammar>> {
+  FileView file(filename);
+  if (!file.data) return Error<>("cannot read: " + filename);
+
+  Reader r{file.data, file.data + file.length};
+  Header header;
+  if (!r.scalar(header) || !(header == Header{}))
+    return Error<>("not a cache of this version: " + filename);
+
+  CompiledTerminals terminals;
+  CompiledGrammar grammar;
+  const uint8_t *classes = nullptr;
+  size_t nClasses = 0;
+  uint64_t n = 0, firstWords = 0;
+  int64_t start = -1;
+  std::vector<int> merges;
+  std::vector<uint8_t> nullable;
+  std::vector<char> skip;
+  bool ok = r.view(classes, nClasses) && nClasses == 256 && r.scalar(n) &&
+            r.array(terminals.transitions) && r.array(terminals.accepts) &&
+            r.strings(terminals.symbols) && r.array(skip) &&
+            r.strings(grammar.symbols) && r.array(grammar.rules) &&
+            r.array(grammar.exprs) && r.array(grammar.alternatives) &&
+            r.array(grammar.alternativesBegin) && r.array(grammar.attribs) &&
+            r.strings(grammar.attributes) && r.array(merges) &&
+            r.array(grammar.mergesBegin) && r.array(grammar.first) &&
+            r.scalar(firstWords) && r.array(nullable) && r.scalar(start);
+  if (!ok) return Error<>("truncated cache: " + filename);
+
+  std::copy(classes, classes + nClasses, begin(terminals.classes));
+  terminals.nClasses = n;
+  terminals.skip.assign(begin(skip), end(skip));
+
+  for (size_t i = 0; i + 1 < size(merges); i += 2)
+    grammar.merges.emplace_back(merges[i], merges[i + 1]);
+  grammar.firstWords = firstWords;
+  grammar.nullable.assign(begin(nullable), end(nullable));
+  grammar.start = int(start);
+  for (size_t i = 0; i != size(grammar.symbols); ++i)
+    grammar.ids.emplace(grammar.symbols[i], int(i));
+  grammar.tables = std::make_shared<detail::Tables>();
+
+  return std::pair{std::move(terminals), std::move(grammar)};
+}
+
+}  // namespace tiny_bnf
@@ -0,0 +1,587 @@
+#include <tiny_bnf_internal.h>
+
+#include <algorithm>
+#include <map>
+#include <set>
+#include <unordered_map>
+
+namespace tiny_bnf {
+
+// LALR(1) automaton of the expanded grammar, augmented with S' := start. The
+// lookaheads are computed with DeRemer and Pennello's relations over the
+// nonterminal transitions of the LR(0) automaton
+struct LrTables {
+  // a shift to state `value` if it is not negative, else a reduction by
+  // production ~value
+  struct Action {
+    int symbol = 0;
+    int32_t value = 0;
+  };
+
+  struct Goto {
+    int symbol = 0;
+    uint32_t state = 0;
+  };
+
+  auto actionsOf(uint32_t state, int symbol) const {
+    return std::equal_range(
+        begin(actions[state]), std::end(actions[state]), Action{symbol, 0},
+        [](auto &a, auto &b) { return a.symbol < b.symbol; });
+  }
+
+  auto gotoOf(uint32_t state, int symbol) const {
+    return std::lower_bound(
+               begin(gotos[state]), std::end(gotos[state]), Goto{symbol, 0},
+               [](auto &a, auto &b) { return a.symbol < b.symbol; })
+        ->state;
+  }
+
+  Bnf bnf;
+  // production S' := start, reduced on the end of the input
+  uint32_t accept = 0;
+  // symbol standing for the end of the input
+  int end = 0;
+  // by state, sorted by symbol
+  std::vector<std::vector<Action>> actions = {};
+  std::vector<std::vector<Goto>> gotos = {};
+};
+
+// Closes the sets over `relation`: F(x) = F(x) | F(y) for each x R y, visiting
+// the strongly connected components once (DeRemer and Pennello's digraph)
+void digraph(const std::vector<std::vector<uint32_t>> &relation,
+             std::vector<uint64_t> &sets, size_t words) {
+  std::vector<uint32_t> depth(size(relation)), stack;
+
+  auto traverse = [&](auto &traverse, uint32_t x) -> void {
+    stack.push_back(x);
+    auto d = uint32_t(size(stack));
+    depth[x] = d;
+    for (auto y : relation[x]) {
+      if (depth[y] == 0) traverse(traverse, y);
+      depth[x] = std::min(depth[x], depth[y]);
+      for (size_t w = 0; w != words; ++w)
+        sets[x * words + w] |= sets[y * words + w];
+    }
+    if (depth[x] == d)
+      for (auto top = kNone; top != x;) {
+        top = stack.back();
+        stack.pop_back();
+        depth[top] = kNone;
+        std::copy_n(&sets[x * words], words, &sets[top * words]);
+      }
+  };
+
+  for (uint32_t x = 0; x != size(relation); ++x)
+    if (depth[x] == 0) traverse(traverse, x);
+}
+
+auto buildLrTables(const CompiledGrammar &g) -> LrTables {
+  LrTables t{expand(g)};
+  auto &bnf = t.bnf;
+
+  auto top = bnf.symbols++;
+  t.end = bnf.symbols++;
+  bnf.alternatives.resize(bnf.symbols);
+  bnf.nullable.resize(bnf.symbols);
+  t.accept = size(bnf.productions);
+  bnf.alternatives[top].push_back(t.accept);
+  bnf.productions.push_back({top, kNone, true, {g.start}, {kNone}});
+
+  // an LR(0) item is the index of its production's first item plus its dot
+  std::vector<uint32_t> itemBase, itemProduction;
+  for (uint32_t p = 0; p != size(bnf.productions); ++p) {
+    itemBase.push_back(size(itemProduction));
+    itemProduction.insert(end(itemProduction),
+                          size(bnf.productions[p].rhs) + 1, p);
+  }
+
+  struct Transition {
+    int symbol = 0;
+    uint32_t state = 0;
+    // index of a nonterminal transition in the lookahead relations
+    uint32_t nt = kNone;
+  };
+
+  std::map<std::vector<uint32_t>, uint32_t> stateIds;
+  std::vector<std::vector<uint32_t>> kernels;
+  std::vector<std::vector<Transition>> transitions;
+  auto state = [&](std::vector<uint32_t> kernel) {
+    auto [it, inserted] = stateIds.insert({kernel, size(kernels)});
+    if (inserted) kernels.push_back(std::move(kernel));
+    return it->second;
+  };
+
+  state({itemBase[t.accept]});
+  std::vector<uint32_t> closed(bnf.symbols, kNone);
+  for (uint32_t s = 0; s != size(kernels); ++s) {
+    auto items = kernels[s];
+    std::map<int, std::vector<uint32_t>> next;
+    for (size_t i = 0; i != size(items); ++i) {
+      auto p = itemProduction[items[i]];
+      auto dot = items[i] - itemBase[p];
+      const auto &rhs = bnf.productions[p].rhs;
+      if (dot == size(rhs)) continue;
+
+      auto x = rhs[dot];
+      next[x].push_back(items[i] + 1);
+      if (bnf.isNonTerminal(x) && closed[x] != s) {
+        closed[x] = s;
+        for (auto q : bnf.alternatives[x]) items.push_back(itemBase[q]);
+      }
+    }
+
+    transitions.emplace_back();
+    for (auto &[x, kernel] : next) {
+      std::sort(begin(kernel), end(kernel));
+      auto target = state(std::move(kernel));
+      transitions[s].push_back({x, target});
+    }
+  }
+
+  auto go = [&](uint32_t s, int x) -> const Transition & {
+    return *std::lower_bound(
+        begin(transitions[s]), end(transitions[s]), Transition{x},
+        [](auto &a, auto &b) { return a.symbol < b.symbol; });
+  };
+
+  std::vector<uint32_t> terminalIds(bnf.symbols, kNone);
+  std::vector<int> terminals;
+  for (int x = 0; x != bnf.symbols; ++x)
+    if (!bnf.isNonTerminal(x)) {
+      terminalIds[x] = size(terminals);
+      terminals.push_back(x);
+    }
+
+  std::vector<std::pair<uint32_t, int>> nts;
+  for (uint32_t s = 0; s != size(transitions); ++s)
+    for (auto &transition : transitions[s])
+      if (bnf.isNonTerminal(transition.symbol)) {
+        transition.nt = size(nts);
+        nts.push_back({s, transition.symbol});
+      }
+
+  // Read sets: terminals that can be shifted right after a nonterminal
+  // transition, possibly after further transitions over nullable symbols
+  auto words = (size(terminals) + 63) / 64;
+  std::vector<uint64_t> follow(size(nts) * words);
+  auto set = [&](size_t nt, int x) {
+    auto b = terminalIds[x];
+    follow[nt * words + b / 64] |= uint64_t(1) << b % 64;
+  };
+
+  std::vector<std::vector<uint32_t>> reads(size(nts)), includes(size(nts));
+  for (uint32_t nt = 0; nt != size(nts); ++nt) {
+    auto [s, x] = nts[nt];
+    auto target = go(s, x).state;
+    for (const auto &transition : transitions[target])
+      if (!bnf.isNonTerminal(transition.symbol))
+        set(nt, transition.symbol);
+      else if (bnf.nullable[transition.symbol])
+        reads[nt].push_back(transition.nt);
+    if (s == 0 && x == g.start) set(nt, t.end);
+  }
+  digraph(reads, follow, words);
+
+  // Follow sets: (p, A) includes (p', B) if B := β A γ with γ nullable and p
+  // is reached from p' over β. A reduction by B := ω in the state reached
+  // from p' over ω looks back at (p', B)
+  std::vector<std::tuple<uint32_t, uint32_t, uint32_t>> lookbacks;
+  for (uint32_t nt = 0; nt != size(nts); ++nt) {
+    auto [start, x] = nts[nt];
+    for (auto q : bnf.alternatives[x]) {
+      const auto &rhs = bnf.productions[q].rhs;
+      auto s = start;
+      for (size_t i = 0; i != size(rhs); ++i) {
+        if (bnf.isNonTerminal(rhs[i]) &&
+            std::all_of(begin(rhs) + i + 1, end(rhs),
+                        [&](int y) { return bnf.nullable[y]; }))
+          includes[go(s, rhs[i]).nt].push_back(nt);
+        s = go(s, rhs[i]).state;
+      }
+      lookbacks.push_back({s, q, nt});
+    }
+  }
+  digraph(includes, follow, words);
+
+  t.actions.resize(size(transitions));
+  t.gotos.resize(size(transitions));
+  for (uint32_t s = 0; s != size(transitions); ++s)
+    for (const auto &transition : transitions[s])
+      if (bnf.isNonTerminal(transition.symbol))
+        t.gotos[s].push_back({transition.symbol, transition.state});
+      else
+        t.actions[s].push_back(
+            {transition.symbol, int32_t(transition.state)});
+
+  std::sort(begin(lookbacks), end(lookbacks));
+  std::vector<uint64_t> lookahead(words);
+  for (auto it = begin(lookbacks); it != end(lookbacks);) {
+    auto [s, q, nt] = *it;
+    std::fill(begin(lookahead), end(lookahead), 0);
+    for (; it != end(lookbacks) && std::get<0>(*it) == s &&
+           std::get<1>(*it) == q;
+         ++it)
+      for (size_t w = 0; w != words; ++w)
+        lookahead[w] |= follow[std::get<2>(*it) * words + w];
+
+    for (size_t b = 0; b != size(terminals); ++b)
+      if (lookahead[b / 64] >> b % 64 & 1)
+        t.actions[s].push_back({terminals[b], ~int32_t(q)});
+  }
+  t.actions[go(0, g.start).state].push_back({t.end, ~int32_t(t.accept)});
+
+  for (auto &actions : t.actions)
+    std::stable_sort(begin(actions), end(actions),
+                     [](auto &a, auto &b) { return a.symbol < b.symbol; });
+
+  return t;
+}
+
+auto lrTables(const CompiledGrammar &g) -> std::shared_ptr<const LrTables> {
+  if (!g.tables) return std::make_shared<const LrTables>(buildLrTables(g));
+  std::call_once(g.tables->lrOnce, [&] {
+    g.tables->lr = std::make_shared<const LrTables>(buildLrTables(g));
+  });
+  return g.tables->lr;
+}
+
+// Tomita style parser over a graph structured stack. Every stack node of a
+// level is a distinct LR state, and each edge is labeled with the derivation
+// it was pushed for. Derivations of a symbol over the same tokens and with
+// the same attributes are packed into one, so the labels form a shared
+// packed forest of the expanded grammar
+struct GlrParser {
+  struct StackNode {
+    uint32_t state = 0;
+    uint32_t level = 0;
+    uint32_t firstEdge = kNone;
+    // nodes of the same level with an edge to this one, over an empty
+    // derivation
+    std::vector<uint32_t> emptyFrom = {};
+  };
+
+  struct Edge {
+    uint32_t target = 0;
+    uint32_t label = 0;
+    uint32_t next = kNone;
+  };
+
+  struct Derivation {
+    int symbol = 0;
+    uint32_t start = 0;
+    uint32_t end = 0;
+    uint32_t attributes = 0;
+    std::vector<uint32_t> families = {};
+  };
+
+  struct Family {
+    uint32_t production = 0;
+    std::vector<uint32_t> children;
+  };
+
+  // reduce by `production` along the paths from `node`, only those that go
+  // through `edge` unless it is kNone
+  struct Reduction {
+    uint32_t node = 0;
+    uint32_t production = 0;
+    uint32_t edge = kNone;
+  };
+
+  struct KeyHash {
+    auto operator()(const std::pair<uint64_t, uint64_t> &key) const
+        -> size_t {
+      auto h = key.first * 0x9E3779B97F4A7C15ull;
+      return size_t(h ^ (key.second + (h << 6) + (h >> 2)));
+    }
+  };
+
+  auto derivation(int symbol, uint32_t start, uint32_t end,
+                  uint32_t attributes) -> uint32_t {
+    auto [it, inserted] = derivationIds.insert(
+        {{uint64_t(symbol) << 32 | start, uint64_t(end) << 32 | attributes},
+         uint32_t(size(derivations))});
+    if (inserted) derivations.push_back({symbol, start, end, attributes});
+    return it->second;
+  }
+
+  auto stackNode(uint32_t state) -> uint32_t {
+    if (atState[state] == kNone) {
+      atState[state] = size(stack);
+      stack.push_back({state, level});
+      nodes.push_back(atState[state]);
+      enqueue(atState[state], kNone);
+    }
+    return atState[state];
+  }
+
+  auto edge(uint32_t from, uint32_t to, uint32_t label) -> uint32_t {
+    for (auto e = stack[from].firstEdge; e != kNone; e = edges[e].next)
+      if (edges[e].target == to && edges[e].label == label) return kNone;
+    edges.push_back({to, label, stack[from].firstEdge});
+    stack[from].firstEdge = size(edges) - 1;
+    if (stack[to].level == level) stack[to].emptyFrom.push_back(from);
+    return stack[from].firstEdge;
+  }
+
+  // actions of `state` on the lookahead, looked up once per level
+  auto actions(uint32_t state) {
+    if (actionsLevel[state] != level + 1) {
+      auto [first, last] = tables.actionsOf(state, lookahead);
+      actionsLevel[state] = level + 1;
+      actionRanges[state] = {&*first, &*first + (last - first)};
+    }
+    return actionRanges[state];
+  }
+
+  void enqueue(uint32_t node, uint32_t edge) {
+    auto [first, last] = actions(stack[node].state);
+    for (auto it = first; it != last; ++it)
+      if (it->value < 0 &&
+          (edge == kNone || size(tables.bnf.productions[~it->value].rhs)))
+        queue.push_back({node, uint32_t(~it->value), edge});
+  }
+
+  void reduce(const Reduction &r, uint32_t node, size_t remaining,
+              bool through, std::vector<uint32_t> &labels) {
+    if (remaining != 0) {
+      for (auto e = stack[node].firstEdge; e != kNone; e = edges[e].next) {
+        labels.push_back(edges[e].label);
+        reduce(r, edges[e].target, remaining - 1, through || e == r.edge,
+               labels);
+        labels.pop_back();
+      }
+      return;
+    }
+    if (!through) return;
+
+    std::vector<uint32_t> children(rbegin(labels), rend(labels));
+    if (r.production == tables.accept) {
+      roots.push_back(children[0]);
+      return;
+    }
+
+    const auto &bnf = tables.bnf;
+    const auto &p = bnf.productions[r.production];
+    // like the Earley items of a repetition, which do not move on over an
+    // empty match, N := N X does not repeat an empty X
+    if (p.generated && size(children) == 2 &&
+        derivations[children[1]].start == derivations[children[1]].end)
+      return;
+    auto attributes = p.generated ? 0 : ruleAttributes(p.rule);
+    for (size_t i = 0; i != size(children); ++i) {
+      const auto &child = derivations[children[i]];
+      if (bnf.isGenerated(child.symbol)) {
+        attributes = sets.unite(attributes, child.attributes);
+      } else if (grammar.isNonTerminal(child.symbol)) {
+        const auto &expr = grammar.exprs[p.exprs[i]];
+        for (auto a = expr.attribsBegin; a != expr.attribsEnd; ++a)
+          if (!sets.contains(child.attributes, grammar.attribs[a])) return;
+        attributes =
+            sets.merge(grammar, attributes, child.symbol, child.attributes);
+      }
+    }
+
+    auto d = derivation(p.symbol, stack[node].level, level, attributes);
+    const auto &known = derivations[d].families;
+    if (std::none_of(begin(known), end(known), [&](uint32_t f) {
+          return families[f].production == r.production &&
+                 families[f].children == children;
+        })) {
+      derivations[d].families.push_back(size(families));
+      families.push_back({r.production, std::move(children)});
+    }
+
+    auto state = tables.gotoOf(stack[node].state, p.symbol);
+    auto existing = atState[state] != kNone;
+    auto w = stackNode(state);
+    auto e = edge(w, node, d);
+    if (!existing || e == kNone) return;
+
+    // paths through the new edge start at `w` or at the nodes of the level
+    // that reach `w` over empty derivations
+    std::vector<uint32_t> from = {w};
+    for (size_t i = 0; i != size(from); ++i) {
+      enqueue(from[i], e);
+      for (auto x : stack[from[i]].emptyFrom)
+        if (std::find(begin(from), end(from), x) == end(from))
+          from.push_back(x);
+    }
+  }
+
+  auto ruleAttributes(uint32_t rule) -> uint32_t {
+    if (cachedAttributes[rule] == kNone)
+      cachedAttributes[rule] = sets.intern(
+          {begin(grammar.attribs) + grammar.rules[rule].attribsBegin,
+           begin(grammar.attribs) + grammar.rules[rule].attribsEnd});
+    return cachedAttributes[rule];
+  }
+
+  auto run(const TokenStream &input) -> Expected<std::vector<uint32_t>> {
+    std::vector<int> tokens;
+    for (const auto &token : input) tokens.push_back(token.symbol);
+    atState.assign(size(tables.actions), kNone);
+    actionsLevel.assign(size(tables.actions), 0);
+    actionRanges.resize(size(tables.actions));
+    cachedAttributes.assign(size(grammar.rules), kNone);
+
+    lookahead = size(tokens) ? tokens[0] : tables.end;
+    stackNode(0);
+
+    for (level = 0;;) {
+      for (size_t q = 0; q != size(queue); ++q) {
+        auto r = queue[q];
+        std::vector<uint32_t> labels;
+        reduce(r, r.node, size(tables.bnf.productions[r.production].rhs),
+               r.edge == kNone, labels);
+      }
+      queue.clear();
+
+      if (level == size(tokens)) break;
+
+      std::vector<std::pair<uint32_t, uint32_t>> shifts;
+      for (auto v : nodes) {
+        auto [first, last] = actions(stack[v].state);
+        for (auto it = first; it != last; ++it)
+          if (it->value >= 0) shifts.push_back({uint32_t(it->value), v});
+        atState[stack[v].state] = kNone;
+      }
+      if (shifts.empty())
+        return Error<>("Unable to parse: unexpected token " +
+                       show(grammar, input[level]));
+
+      auto leaf = derivation(tokens[level], level, level + 1, 0);
+      level += 1;
+      lookahead = level != size(tokens) ? tokens[level] : tables.end;
+      nodes.clear();
+      for (auto [state, v] : shifts) edge(stackNode(state), v, leaf);
+    }
+
+    if (roots.empty()) return Error<>("Unable to parse: unexpected end");
+    return roots;
+  }
+
+  const CompiledGrammar &grammar;
+  const LrTables &tables;
+  std::vector<StackNode> stack = {};
+  std::vector<Edge> edges = {};
+  std::vector<Derivation> derivations = {};
+  // by (symbol, start) and (end, attributes)
+  std::unordered_map<std::pair<uint64_t, uint64_t>, uint32_t, KeyHash>
+      derivationIds = {};
+  std::vector<Family> families = {};
+  AttributeSets sets = {};
+  std::vector<uint32_t> cachedAttributes = {};
+
+  // state of the current level
+  uint32_t level = 0;
+  int lookahead = 0;
+  std::vector<uint32_t> nodes = {};
+  std::vector<uint32_t> atState = {};
+  std::vector<Reduction> queue = {};
+  std::vector<uint32_t> actionsLevel = {};
+  std::vector<std::pair<const LrTables::Action *, const LrTables::Action *>>
+      actionRanges = {};
+
+  std::vector<uint32_t> roots = {};
+};
+
+// Turns the derivations of a GlrParser into a Forest of the original grammar,
+// splicing the generated symbols and the intermediate, alias or deref nodes
+struct GlrForestBuilder : ForestWriter {
+  auto inlined(uint32_t production) const {
+    const auto &p = parser.tables.bnf.productions[production];
+    return p.generated || parser.grammar.rules[p.rule].intermediate;
+  }
+
+  // sequences that derivation `d` contributes to the children of its parent
+  auto contribution(uint32_t d, bool splice) -> Sequences {
+    const auto &derivation = parser.derivations[d];
+    if (!parser.tables.bnf.isGenerated(derivation.symbol) &&
+        !parser.grammar.isNonTerminal(derivation.symbol))
+      return {{node(derivation.symbol, derivation.start, derivation.end,
+                    true)}};
+
+    Sequences result;
+    bool own = false;
+    for (auto f : derivation.families)
+      if (splice || inlined(parser.families[f].production)) {
+        const auto &seqs = sequences(f);
+        result.insert(end(result), begin(seqs), end(seqs));
+      } else {
+        own = true;
+      }
+    if (own) result.push_back({symbolNode(d)});
+    return result;
+  }
+
+  auto symbolNode(uint32_t d) -> uint32_t {
+    const auto &derivation = parser.derivations[d];
+    auto n = node(derivation.symbol, derivation.start, derivation.end, false);
+    if (expanded.insert(d).second)
+      for (auto f : derivation.families)
+        if (!inlined(parser.families[f].production))
+          addFamilies(n, sequences(f));
+    return n;
+  }
+
+  // children sequences of family `f`, with spliced children inlined
+  auto sequences(uint32_t f) -> const Sequences & {
+    static const Sequences none;
+    if (auto it = memo.find(f); it != end(memo)) return it->second;
+    if (!active.insert(f).second) return none;
+
+    const auto &g = parser.grammar;
+    const auto &family = parser.families[f];
+    const auto &p = parser.tables.bnf.productions[family.production];
+    Sequences result = {{}};
+    for (size_t i = 0; i != size(family.children); ++i) {
+      auto splice = g.rules[p.rule].alias || g.exprs[p.exprs[i]].deref;
+      auto children = contribution(family.children[i], splice);
+      Sequences next;
+      for (const auto &prefix : result)
+        for (const auto &c : children) {
+          auto seq = prefix;
+          seq.insert(end(seq), begin(c), end(c));
+          next.push_back(std::move(seq));
+        }
+      result = std::move(next);
+    }
+
+    active.erase(f);
+    return memo[f] = std::move(result);
+  }
+
+  const GlrParser &parser;
+  std::pmr::set<uint32_t> expanded{&memory};
+  std::pmr::map<uint32_t, Sequences> memo{&memory};
+  std::pmr::set<uint32_t> active{&memory};
+};
+
+auto parseGLR(const CompiledGrammar &g, const TokenStream &tokens)
+    -> Expected<std::vector<Node>> {
+  if (g.start == -1) return Error<>("empty specification");
+  auto tables = lrTables(g);
+
+  GlrParser parser{g, *tables};
+  auto roots = parser.run(tokens);
+  if (!roots) return Error<>(roots.error());
+
+  GlrForestBuilder builder{{}, parser};
+  builder.forest.grammar = &g;
+  builder.forest.root = builder.node(g.start, 0, size(tokens), false);
+  for (auto d : *roots)
+    for (auto f : parser.derivations[d].families)
+      builder.addFamilies(builder.forest.root, builder.sequences(f));
+  builder.finish();
+  for (const auto &token : tokens) builder.forest.text.push_back(token.text);
+
+  // the trees of a forest are distinct by construction
+  std::vector<Node> nodes;
+  forEachTree(builder.forest, [&](const Node &node) {
+    nodes.push_back(node);
+    return true;
+  });
+  return nodes;
+}
+
+}  // namespace tiny_bnf
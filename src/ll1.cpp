@@ -0,0 +1,394 @@
+#include <tiny_bnf_internal.h>
+
+#include <algorithm>
+#include <map>
+
+namespace tiny_bnf {
+
+// LL(1) tables of the expanded grammar, once its optional symbols are inlined,
+// its immediate left recursion is removed and its rules are left factored.
+// The symbols of the expanded grammar keep their ids, the factors and tails
+// introduced by the rewriting follow them. `ll1` is false if there is a
+// conflict, in which case the tables are incomplete
+struct LlTables {
+  enum Kind : uint8_t {
+    Terminal,
+    NonTerminal,
+    // rest of the rules of a symbol after a common prefix, its children and
+    // production are spliced into the symbol
+    Factor,
+    // A := A α | β, rewritten into A := B T, B := β, T := R T | ε, R := α
+    Folded,
+    Tail
+  };
+
+  struct Rule {
+    std::vector<int> rhs = {};
+    // production of the expanded grammar that ends with this rule, kNone if
+    // a trailing factor picks it
+    uint32_t production = kNone;
+  };
+
+  auto predict(int symbol, int terminal) const -> uint32_t {
+    auto it = std::lower_bound(
+        begin(table[symbol]), std::end(table[symbol]),
+        std::pair{terminal, uint32_t(0)},
+        [](auto &a, auto &b) { return a.first < b.first; });
+    return it != std::end(table[symbol]) && it->first == terminal ? it->second
+                                                                  : kNone;
+  }
+
+  // productions of the expanded grammar with their optional symbols inlined
+  std::vector<Bnf::Production> productions;
+  std::vector<Kind> kinds;
+  std::vector<Rule> rules;
+  std::vector<std::vector<uint32_t>> alternatives;
+  // by symbol, (terminal, rule) pairs sorted by terminal
+  std::vector<std::vector<std::pair<int, uint32_t>>> table;
+  int end = 0;
+  bool ll1 = true;
+};
+
+// productions of `bnf` with each generated symbol of an optional expr
+// replaced by the expr's symbol or by nothing
+auto inlineOptionals(const Bnf &bnf) -> std::vector<Bnf::Production> {
+  auto optional = [&](int symbol) {
+    if (!bnf.isGenerated(symbol) || size(bnf.alternatives[symbol]) != 2)
+      return false;
+    const auto &a = bnf.productions[bnf.alternatives[symbol][0]];
+    const auto &b = bnf.productions[bnf.alternatives[symbol][1]];
+    return a.rhs.empty() && size(b.rhs) == 1 && b.rhs[0] != symbol;
+  };
+
+  std::vector<Bnf::Production> productions;
+  for (const auto &p : bnf.productions) {
+    std::vector<Bnf::Production> variants = {{p.symbol, p.rule, p.generated}};
+    for (size_t i = 0; i != size(p.rhs); ++i) {
+      auto n = size(variants);
+      // a rule with many optional symbols is better left to the parser
+      if (optional(p.rhs[i]) && n <= 256) {
+        const auto &x = bnf.productions[bnf.alternatives[p.rhs[i]][1]];
+        for (size_t v = 0; v != n; ++v) {
+          variants.push_back(variants[v]);
+          variants.back().rhs.push_back(x.rhs[0]);
+          variants.back().exprs.push_back(x.exprs[0]);
+        }
+      } else {
+        for (auto &v : variants) {
+          v.rhs.push_back(p.rhs[i]);
+          v.exprs.push_back(p.exprs[i]);
+        }
+      }
+    }
+    productions.insert(end(productions), begin(variants), end(variants));
+  }
+  return productions;
+}
+
+auto buildLlTables(const CompiledGrammar &g) -> LlTables {
+  auto bnf = expand(g);
+  LlTables t;
+  t.productions = inlineOptionals(bnf);
+  t.end = bnf.symbols;
+
+  auto symbol = [&](LlTables::Kind kind) -> int {
+    t.kinds.push_back(kind);
+    t.alternatives.emplace_back();
+    return size(t.kinds) - 1;
+  };
+  auto rule = [&](int lhs, std::vector<int> rhs, uint32_t production) {
+    t.alternatives[lhs].push_back(size(t.rules));
+    t.rules.push_back({std::move(rhs), production});
+  };
+
+  std::vector<std::vector<uint32_t>> alternatives(bnf.symbols);
+  for (uint32_t p = 0; p != size(t.productions); ++p)
+    alternatives[t.productions[p].symbol].push_back(p);
+  for (int x = 0; x != bnf.symbols; ++x)
+    symbol(size(alternatives[x]) ? LlTables::NonTerminal : LlTables::Terminal);
+  symbol(LlTables::Terminal);
+
+  // rules of `lhs` deriving the rhs of `productions` from `offset` on, with
+  // common prefixes moved into a rule that ends with a new factor symbol
+  auto factor = [&](auto &factor, int lhs, const std::vector<uint32_t> &ps,
+                    size_t offset) -> void {
+    std::map<int, std::vector<uint32_t>> groups;
+    auto ended = kNone;
+    for (auto p : ps) {
+      const auto &rhs = t.productions[p].rhs;
+      if (offset != size(rhs))
+        groups[rhs[offset]].push_back(p);
+      else if (ended != kNone)
+        t.ll1 = false;
+      else
+        ended = p;
+    }
+    if (ended != kNone) rule(lhs, {}, ended);
+
+    for (const auto &[x, group] : groups) {
+      const auto &first = t.productions[group[0]].rhs;
+      auto k = offset + 1;
+      while (std::all_of(begin(group), end(group), [&](uint32_t p) {
+        const auto &rhs = t.productions[p].rhs;
+        return k < size(rhs) && rhs[k] == first[k];
+      }))
+        ++k;
+
+      std::vector<int> rhs(begin(first) + offset, begin(first) + k);
+      if (size(group) == 1 && k == size(first)) {
+        rule(lhs, std::move(rhs), group[0]);
+      } else {
+        auto f = symbol(LlTables::Factor);
+        rhs.push_back(f);
+        rule(lhs, std::move(rhs), kNone);
+        factor(factor, f, group, k);
+      }
+    }
+  };
+
+  for (int x = 0; x != bnf.symbols; ++x) {
+    std::vector<uint32_t> base, recursive;
+    for (auto p : alternatives[x]) {
+      const auto &rhs = t.productions[p].rhs;
+      (size(rhs) && rhs[0] == x ? recursive : base).push_back(p);
+    }
+
+    if (recursive.empty()) {
+      factor(factor, x, base, 0);
+      continue;
+    }
+    // A := A is cyclic, and A := A α alone derives nothing
+    for (auto p : recursive)
+      if (size(t.productions[p].rhs) == 1) t.ll1 = false;
+    if (base.empty()) t.ll1 = false;
+
+    t.kinds[x] = LlTables::Folded;
+    auto b = symbol(LlTables::Factor);
+    auto tail = symbol(LlTables::Tail);
+    auto r = symbol(LlTables::Factor);
+    rule(x, {b, tail}, kNone);
+    rule(tail, {r, tail}, kNone);
+    rule(tail, {}, kNone);
+    factor(factor, b, base, 0);
+    factor(factor, r, recursive, 1);
+  }
+  if (!t.ll1) return t;
+
+  // FIRST and FOLLOW sets as bitsets over symbol ids
+  auto symbols = size(t.kinds);
+  auto words = (symbols + 63) / 64;
+  std::vector<bool> nullable(symbols);
+  std::vector<uint64_t> first(symbols * words), follow(symbols * words);
+  for (size_t x = 0; x != symbols; ++x)
+    if (t.kinds[x] == LlTables::Terminal)
+      first[x * words + x / 64] |= uint64_t(1) << x % 64;
+
+  auto unite = [&](uint64_t *dst, const uint64_t *src) {
+    bool changed = false;
+    for (size_t w = 0; w != words; ++w)
+      if ((dst[w] | src[w]) != dst[w]) (dst[w] |= src[w], changed = true);
+    return changed;
+  };
+  // adds FIRST(rhs[i..]) to `dst`, returns whether rhs[i..] is nullable
+  auto firstOf = [&](uint64_t *dst, const std::vector<int> &rhs, size_t i,
+                     bool &changed) {
+    for (; i != size(rhs); ++i) {
+      changed = unite(dst, &first[rhs[i] * words]) || changed;
+      if (!nullable[rhs[i]]) return false;
+    }
+    return true;
+  };
+
+  for (bool changed = true; changed;) {
+    changed = false;
+    for (size_t x = 0; x != symbols; ++x)
+      for (auto r : t.alternatives[x])
+        if (firstOf(&first[x * words], t.rules[r].rhs, 0, changed) &&
+            !nullable[x])
+          nullable[x] = changed = true;
+  }
+
+  follow[g.start * words + t.end / 64] |= uint64_t(1) << t.end % 64;
+  for (bool changed = true; changed;) {
+    changed = false;
+    for (size_t x = 0; x != symbols; ++x)
+      for (auto r : t.alternatives[x]) {
+        const auto &rhs = t.rules[r].rhs;
+        for (size_t i = 0; i != size(rhs); ++i)
+          if (t.kinds[rhs[i]] != LlTables::Terminal &&
+              firstOf(&follow[rhs[i] * words], rhs, i + 1, changed))
+            changed = unite(&follow[rhs[i] * words], &follow[x * words]) ||
+                      changed;
+      }
+  }
+
+  // a rule is predicted by FIRST of its rhs, and by FOLLOW of its lhs if the
+  // rhs is nullable. Two rules predicted by the same terminal conflict
+  t.table.resize(symbols);
+  std::vector<uint64_t> predicted(words);
+  for (size_t x = 0; x != symbols; ++x)
+    for (auto r : t.alternatives[x]) {
+      std::fill(begin(predicted), end(predicted), 0);
+      bool changed = false;
+      if (firstOf(predicted.data(), t.rules[r].rhs, 0, changed))
+        unite(predicted.data(), &follow[x * words]);
+      for (size_t b = 0; b != symbols; ++b)
+        if (predicted[b / 64] >> b % 64 & 1)
+          t.table[x].push_back({int(b), r});
+    }
+
+  for (auto &row : t.table) {
+    std::sort(begin(row), end(row));
+    if (std::adjacent_find(begin(row), end(row), [](auto &a, auto &b) {
+          return a.first == b.first;
+        }) != end(row))
+      t.ll1 = false;
+  }
+  return t;
+}
+
+auto llTables(const CompiledGrammar &g) -> std::shared_ptr<const LlTables> {
+  if (!g.tables) return std::make_shared<const LlTables>(buildLlTables(g));
+  std::call_once(g.tables->llOnce, [&] {
+    g.tables->ll = std::make_shared<const LlTables>(buildLlTables(g));
+  });
+  return g.tables->ll;
+}
+
+// Predictive recursive descent parser that builds the tree of the original
+// grammar directly. Whether a child is spliced depends on the production of
+// its parent, which is only known once the last factor of the parent is
+// parsed, so children stay pending until then
+struct LlParser {
+  struct Child {
+    int symbol = 0;
+    // kNone for a token
+    uint32_t production = kNone;
+    std::vector<Node> children = {};
+    std::string_view text = {};
+  };
+
+  struct Partial {
+    uint32_t production = kNone;
+    std::vector<Child> children = {};
+  };
+
+  auto lookahead() const {
+    return position != size(tokens) ? tokens[position].symbol : t.end;
+  }
+
+  auto fail() {
+    error = position != size(tokens)
+                ? "Unable to parse: unexpected token " +
+                      show(g, tokens[position])
+                : "Unable to parse: unexpected end";
+    return false;
+  }
+
+  // children of the node of `partial`, with the spliced ones inlined
+  auto finish(Partial &partial) -> std::vector<Node> {
+    const auto &p = t.productions[partial.production];
+    std::vector<Node> nodes;
+    for (size_t i = 0; i != size(partial.children); ++i) {
+      auto &child = partial.children[i];
+      if (child.production == kNone) {
+        nodes.push_back(
+            {g.symbols[child.symbol], {}, child.text, child.symbol});
+      } else if (g.rules[p.rule].alias || g.exprs[p.exprs[i]].deref ||
+                 t.productions[child.production].generated ||
+                 g.rules[t.productions[child.production].rule].intermediate) {
+        for (auto &node : child.children) nodes.push_back(std::move(node));
+      } else {
+        auto text = span(child.children);
+        nodes.push_back({g.symbols[child.symbol], std::move(child.children),
+                         text, child.symbol});
+      }
+    }
+    return nodes;
+  }
+
+  // appends the children that `symbol` derives at the current token
+  auto parse(int symbol, Partial &partial) -> bool {
+    switch (t.kinds[symbol]) {
+      case LlTables::Terminal:
+        if (lookahead() != symbol) return fail();
+        partial.children.push_back({symbol, kNone, {}, tokens[position].text});
+        ++position;
+        return true;
+      case LlTables::Factor:
+        return expand(symbol, partial);
+      default: {
+        Partial derived;
+        if (!expand(symbol, derived)) return false;
+        auto production = derived.production;
+        partial.children.push_back({symbol, production, finish(derived)});
+        return true;
+      }
+    }
+  }
+
+  auto expand(int symbol, Partial &partial) -> bool {
+    if (t.kinds[symbol] == LlTables::Folded) {
+      // each repetition of the tail makes the symbol so far its first child
+      const auto &rhs = t.rules[t.alternatives[symbol][0]].rhs;
+      if (!expand(rhs[0], partial)) return false;
+      for (;;) {
+        auto r = t.predict(rhs[1], lookahead());
+        if (r == kNone) return fail();
+        if (t.rules[r].rhs.empty()) return true;
+
+        Partial next;
+        auto production = partial.production;
+        next.children.push_back({symbol, production, finish(partial)});
+        if (!expand(t.rules[r].rhs[0], next)) return false;
+        partial = std::move(next);
+      }
+    }
+
+    auto r = t.predict(symbol, lookahead());
+    if (r == kNone) return fail();
+    for (auto x : t.rules[r].rhs)
+      if (!parse(x, partial)) return false;
+    if (t.rules[r].production != kNone)
+      partial.production = t.rules[r].production;
+    return true;
+  }
+
+  const CompiledGrammar &g;
+  const LlTables &t;
+  const TokenStream &tokens;
+  size_t position = 0;
+  std::string error = {};
+};
+
+auto isLL1(const CompiledGrammar &g) -> bool {
+  // attribute requirements filter derivations by more than their tokens
+  if (g.start == -1 ||
+      std::any_of(begin(g.exprs), end(g.exprs),
+                  [](auto &e) { return e.attribsBegin != e.attribsEnd; }))
+    return false;
+  return llTables(g)->ll1;
+}
+
+auto parseLL1(const CompiledGrammar &g, const TokenStream &tokens)
+    -> Expected<std::vector<Node>> {
+  if (g.start == -1) return Error<>("empty specification");
+  if (!isLL1(g)) return Error<>("grammar is not LL(1)");
+  auto tables = llTables(g);
+
+  LlParser parser{g, *tables, tokens};
+
+  LlParser::Partial root;
+  if (!parser.parse(g.start, root)) return Error<>(parser.error);
+  if (parser.lookahead() != tables->end) {
+    parser.fail();
+    return Error<>(parser.error);
+  }
+  auto &children = root.children[0].children;
+  auto text = span(children);
+  std::vector<Node> trees;
+  trees.push_back({g.symbols[g.start], std::move(children), text, g.start});
+  return trees;
+}
+
+}  // namespace tiny_bnf
@@ -0,0 +1,113 @@
+#include <tiny_bnf_internal.h>
+
+#include <cstdio>
+
+namespace tiny_bnf {
+
+namespace detail {
+
+struct RuleProfile {
+  const CompiledGrammar &grammar;
+  std::mutex mutex = {};
+  std::vector<RuleCost> costs = {};
+};
+
+}  // namespace detail
+
+namespace {
+
+// `rule` as it would be written in a grammar file
+auto describe(const CompiledGrammar &g, const CompiledGrammar::Rule &rule)
+    -> std::string {
+  auto text = g.symbols[rule.symbol] + " " + std::to_string(rule.idx) +
+              (rule.intermediate ? " ==" : " >=");
+  for (auto e = rule.exprBegin; e != rule.exprEnd; ++e) {
+    const auto &expr = g.exprs[e];
+    text += " " + g.symbols[expr.symbol];
+    if (expr.attribsBegin != expr.attribsEnd) {
+      text += "{";
+      for (auto a = expr.attribsBegin; a != expr.attribsEnd; ++a)
+        text += (a == expr.attribsBegin ? "" : " ") +
+                g.attributes[g.attribs[a]];
+      text += "}";
+    }
+    text += expr.optional ? "?" : "";
+    text += expr.arbitrary ? "*" : "";
+    text += expr.oneOrMore ? "+" : "";
+    text += expr.deref ? "&" : "";
+  }
+  return text;
+}
+
+}  // namespace
+
+RuleProfiler::RuleProfiler(const CompiledGrammar &grammar)
+    : profile(new detail::RuleProfile{grammar}) {
+  profile->costs.resize(size(grammar.rules));
+  for (uint32_t r = 0; r != size(grammar.rules); ++r)
+    profile->costs[r].rule = r;
+}
+
+RuleProfiler::~RuleProfiler() = default;
+
+void RuleProfiler::onSet(const SetStats &stats) {
+  if (!stats.rules) return;
+  auto work = stats.items + stats.completions;
+  std::lock_guard lock(profile->mutex);
+  for (size_t r = 0; r != size(profile->costs); ++r) {
+    const auto &rule = stats.rules[r];
+    auto &cost = profile->costs[r];
+    cost.items += rule.items;
+    cost.completions += rule.completions;
+    if (work)
+      cost.seconds += stats.seconds * double(rule.items + rule.completions) /
+                      double(work);
+  }
+}
+
+auto RuleProfiler::report(Order order) const -> std::vector<RuleCost> {
+  std::vector<RuleCost> costs;
+  {
+    std::lock_guard lock(profile->mutex);
+    for (const auto &cost : profile->costs)
+      if (cost.items) costs.push_back(cost);
+  }
+
+  auto key = [order](const RuleCost &c) {
+    return order == Items         ? double(c.items)
+           : order == Completions ? double(c.completions)
+                                  : c.seconds;
+  };
+  std::stable_sort(begin(costs), end(costs), [&](auto &a, auto &b) {
+    return key(a) > key(b);
+  });
+  return costs;
+}
+
+void RuleProfiler::print(std::ostream &out, Order order, size_t limit) const {
+  auto costs = report(order);
+  RuleCost total;
+  for (const auto &cost : costs) {
+    total.items += cost.items;
+    total.completions += cost.completions;
+    total.seconds += cost.seconds;
+  }
+  auto share = [](double part, double whole) {
+    return whole ? 100 * part / whole : 0.0;
+  };
+
+  out << "     items      %  completions      %         ms      %  rule\n";
+  char line[128];
+  for (size_t i = 0; i != std::min(limit, size(costs)); ++i) {
+    const auto &c = costs[i];
+    std::snprintf(line, sizeof line,
+                  "%10zu %5.1f%% %12zu %5.1f%% %10.3f %5.1f%%  ", c.items,
+                  share(c.items, total.items), c.completions,
+                  share(c.completions, total.completions), c.seconds * 1e3,
+                  share(c.seconds, total.seconds));
+    out << line
+        << describe(profile->grammar, profile->grammar.rules[c.rule]) << '\n';
+  }
+}
+
+}  // namespace tiny_bnf
@@ -0,0 +1,122 @@
+#include <tiny_bnf_internal.h>
+
+#if (defined(__x86_64__) || defined(__i386__)) && defined(__GNUC__)
+#include <immintrin.h>
+#define TINY_BNF_X86 1
+#endif
+
+namespace tiny_bnf {
+
+namespace {
+
+auto scanWordScalar(std::string_view s, size_t i) -> size_t {
+  while (i != size(s) && isWord(s[i])) ++i;
+  return i;
+}
+
+auto scanSkipScalar(std::string_view s, size_t i, std::string_view bytes)
+    -> size_t {
+  while (i != size(s) && bytes.find(s[i]) != std::string_view::npos) ++i;
+  return i;
+}
+
+#ifdef TINY_BNF_X86
+
+// Blocks are classified with signed byte compares: adding 128 - 'a' to a byte
+// folded to lower case moves 'a'..'z' to the bottom of the signed range
+
+__attribute__((target("sse2"))) auto scanWordSse2(std::string_view s,
+                                                  size_t i) -> size_t {
+  const auto fold = _mm_set1_epi8(0x20), shift = _mm_set1_epi8(128 - 'a');
+  const auto letters = _mm_set1_epi8(-128 + 26), under = _mm_set1_epi8('_');
+  for (; i + 16 <= size(s); i += 16) {
+    auto v = _mm_loadu_si128((const __m128i *)(s.data() + i));
+    auto lower = _mm_add_epi8(_mm_or_si128(v, fold), shift);
+    auto word = _mm_or_si128(_mm_cmplt_epi8(lower, letters),
+                             _mm_cmpeq_epi8(v, under));
+    if (auto mask = ~_mm_movemask_epi8(word) & 0xffff)
+      return i + __builtin_ctz(mask);
+  }
+  return scanWordScalar(s, i);
+}
+
+__attribute__((target("sse2"))) auto scanSkipSse2(std::string_view s,
+                                                  size_t i,
+                                                  std::string_view bytes)
+    -> size_t {
+  for (; i + 16 <= size(s); i += 16) {
+    auto v = _mm_loadu_si128((const __m128i *)(s.data() + i));
+    auto skip = _mm_setzero_si128();
+    for (auto c : bytes)
+      skip = _mm_or_si128(skip, _mm_cmpeq_epi8(v, _mm_set1_epi8(c)));
+    if (auto mask = ~_mm_movemask_epi8(skip) & 0xffff)
+      return i + __builtin_ctz(mask);
+  }
+  return scanSkipScalar(s, i, bytes);
+}
+
+__attribute__((target("avx2"))) auto scanWordAvx2(std::string_view s,
+                                                  size_t i) -> size_t {
+  const auto fold = _mm256_set1_epi8(0x20), shift = _mm256_set1_epi8(128 - 'a');
+  const auto letters = _mm256_set1_epi8(-128 + 26);
+  const auto under = _mm256_set1_epi8('_');
+  for (; i + 32 <= size(s); i += 32) {
+    auto v = _mm256_loadu_si256((const __m256i *)(s.data() + i));
+    auto lower = _mm256_add_epi8(_mm256_or_si256(v, fold), shift);
+    auto word = _mm256_or_si256(_mm256_cmpgt_epi8(letters, lower),
+                                _mm256_cmpeq_epi8(v, under));
+    if (auto mask = ~uint32_t(_mm256_movemask_epi8(word)))
+      return i + __builtin_ctz(mask);
+  }
+  return scanWordSse2(s, i);
+}
+
+__attribute__((target("avx2"))) auto scanSkipAvx2(std::string_view s,
+                                                  size_t i,
+                                                  std::string_view bytes)
+    -> size_t {
+  for (; i + 32 <= size(s); i += 32) {
+    auto v = _mm256_loadu_si256((const __m256i *)(s.data() + i));
+    auto skip = _mm256_setzero_si256();
+    for (auto c : bytes)
+      skip = _mm256_or_si256(skip, _mm256_cmpeq_epi8(v, _mm256_set1_epi8(c)));
+    if (auto mask = ~uint32_t(_mm256_movemask_epi8(skip)))
+      return i + __builtin_ctz(mask);
+  }
+  return scanSkipSse2(s, i, bytes);
+}
+
+#endif
+
+struct Scanners {
+  decltype(&scanWordScalar) word = scanWordScalar;
+  decltype(&scanSkipScalar) skip = scanSkipScalar;
+};
+
+auto scanners() -> const Scanners & {
+  static const Scanners chosen = [] {
+    Scanners s;
+#ifdef TINY_BNF_X86
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2"))
+      s = {scanWordAvx2, scanSkipAvx2};
+    else if (__builtin_cpu_supports("sse2"))
+      s = {scanWordSse2, scanSkipSse2};
+#endif
+    return s;
+  }();
+  return chosen;
+}
+
+}  // namespace
+
+auto scanWord(std::string_view s, size_t i) -> size_t {
+  return scanners().word(s, i);
+}
+
+auto scanSkip(std::string_view s, size_t i, std::string_view bytes)
+    -> size_t {
+  return scanners().skip(s, i, bytes);
+}
+
+}  // namespace tiny_bnf
@@ -0,0 +1,274 @@
+#include <tiny_bnf_internal.h>
+
+#include <deque>
+
+namespace tiny_bnf {
+
+namespace {
+
+// Token of a grammar file, with its 1-based position for error messages
+struct SpecToken {
+  std::string text;
+  uint32_t line = 0;
+  uint32_t column = 0;
+};
+
+struct SpecLine {
+  std::string text;
+  std::vector<SpecToken> tokens;
+  // the template this line was expanded from, if any
+  const SpecToken *expandedFrom = nullptr;
+};
+
+auto isBlank(char c) { return c == ' ' || c == '\t' || c == '\r'; }
+
+auto isPunctuation(std::string_view token) {
+  return token == "->" || token == ">=" || token == "==" ||
+         (size(token) == 1 &&
+                           std::string_view("()?*+&:|\\[]{},").find(
+                               token[0]) != std::string_view::npos);
+}
+
+// Splits a line into symbols and punctuation. Each punctuation character
+// stands on its own, as does "->", and blanks only separate symbols
+auto lex(std::string_view line, uint32_t number) -> std::vector<SpecToken> {
+  std::vector<SpecToken> tokens;
+  for (size_t i = 0; i != size(line);) {
+    auto length = line.compare(i, 2, "->") == 0 ? 2
+                  : isPunctuation(line.substr(i, 1)) ? 1
+                                                     : 0;
+    if (isBlank(line[i])) {
+      ++i;
+      continue;
+    }
+    if (length == 0)
+      while (i + length != size(line) && !isBlank(line[i + length]) &&
+             !isPunctuation(line.substr(i + length, 1)) &&
+             line.compare(i + length, 2, "->") != 0)
+        ++length;
+    tokens.push_back({std::string(line.substr(i, length)), number,
+                      uint32_t(i + 1)});
+    i += length;
+  }
+  return tokens;
+}
+
+// Parses the rules of a grammar file into a Specification, one line at a
+// time, after the template lines have been expanded into rule lines
+struct SpecParser {
+  using Tokens = std::vector<SpecToken>;
+  using Iterator = Tokens::const_iterator;
+
+  auto fail(const SpecLine &line, const SpecToken &at,
+            const std::string &message) -> bool {
+    error = std::to_string(at.line) + ":" + std::to_string(at.column) + ": ";
+    if (line.expandedFrom)
+      error += "in an expansion of " + line.expandedFrom->text + ": ";
+    error += message;
+    return false;
+  }
+
+  // the operator of a rule line, after its symbol and attributes
+  static auto findOperator(const Tokens &tokens) -> Iterator {
+    return std::find_if(begin(tokens), end(tokens), [](const SpecToken &t) {
+      return t.text == ">=" || t.text == "==";
+    });
+  }
+
+  // appends the attributes from `at`, which is at "{", up to "}" to `out`
+  auto attributes(const SpecLine &line, Iterator &at,
+                  std::vector<std::string> &out) -> bool {
+    const auto &open = *at;
+    for (++at; at != end(line.tokens) && at->text != "}"; ++at) {
+      if (isPunctuation(at->text))
+        return fail(line, *at, "expected an attribute or }");
+      out.push_back(at->text);
+    }
+    if (at == end(line.tokens)) return fail(line, open, "unclosed {");
+    return true;
+  }
+
+  // symbol {attributes} >= or == alternatives
+  auto rule(const SpecLine &line) -> bool {
+    const auto &tokens = line.tokens;
+    auto at = begin(tokens);
+    if (isPunctuation(at->text))
+      return fail(line, *at, "expected the symbol of a rule");
+    spec.addSymbol(at->text);
+
+    // A rule provides the attributes after its symbol or, without those, the
+    // ones it requires first, as `IML >= IML{v} CONJP` passes v on
+    auto provides = std::find_if(at, end(tokens),
+                                 [](auto &token) { return token.text == "{"; });
+    if (provides != end(tokens)) {
+      std::vector<std::string> provided;
+      if (!attributes(line, provides, provided)) return false;
+      for (auto &a : provided) spec.activeRule().attributes.insert(a);
+    }
+    if (++at != end(tokens) && at->text == "{") at = provides + 1;
+
+    if (at == end(tokens) || (at->text != ">=" && at->text != "=="))
+      return fail(line, at != end(tokens) ? *at : tokens.back(),
+                  "expected >= or ==");
+    if (at->text == "==") spec.setIntermediate();
+    if (at + 1 == end(tokens))
+      return fail(line, *at, "expected symbols after " + at->text);
+
+    std::vector<Iterator> parentheses;
+    for (++at; at != end(tokens); ++at) {
+      const auto &t = at->text;
+      auto &exprs = spec.activeRule().expr;
+      if (t == "\\") {
+        if (at + 1 == end(tokens))
+          return fail(line, *at, "expected a symbol after \\");
+        spec.addExpr((++at)->text);
+      } else if (t == "|") {
+        spec.addAlternative();
+      } else if (t == "(") {
+        parentheses.push_back(at);
+        spec.addLeftParenthesis();
+      } else if (t == ")") {
+        if (parentheses.empty()) return fail(line, *at, "unmatched )");
+        parentheses.pop_back();
+        spec.addRightParenthesis();
+      } else if (t == "{" || t == "?" || t == "*" || t == "+" || t == "&") {
+        if (exprs.empty()) return fail(line, *at, t + " follows no symbol");
+        if (t == "{" && !attributes(line, at, exprs.back().attribs))
+          return false;
+        exprs.back().optional |= t == "?";
+        exprs.back().arbitrary |= t == "*";
+        exprs.back().oneOrMore |= t == "+";
+        exprs.back().deref |= t == "&";
+      } else if (t == "}" || t == "[" || t == "]" || t == "->" || t == ">=" ||
+                 t == "==") {
+        return fail(line, *at, "unexpected " + t);
+      } else {
+        spec.addExpr(t);
+      }
+    }
+
+    if (!parentheses.empty())
+      return fail(line, *parentheses.back(), "unclosed (");
+    return true;
+  }
+
+  // The replacements `symbol -> symbols, ...` of the template at `open`. A
+  // replacement may be empty, and \ escapes the punctuation that follows it
+  auto replacements(const SpecLine &line, Iterator open, Iterator close,
+                    std::map<std::string, std::string> &map) -> bool {
+    for (auto at = open + 1; at != close;) {
+      auto key = at;
+      if (isPunctuation(key->text))
+        return fail(line, *key, "expected a symbol to replace");
+      if (++at == close || at->text != "->")
+        return fail(line, at != close ? *at : *key, "expected ->");
+
+      std::string value;
+      for (++at; at != close && at->text != ","; ++at) {
+        if (at->text == "\\" && at + 1 != close)
+          ++at;
+        else if (at->text == "->" || at->text == "\\")
+          return fail(line, *at, "unexpected " + at->text);
+        value += (value.empty() ? "" : " ") + at->text;
+      }
+      if (!map.emplace(key->text, value).second)
+        return fail(line, *key, key->text + " is replaced twice");
+      if (at != close) ++at;
+    }
+    return true;
+  }
+
+  // Appends a rule line for each rule line of the template symbol, with the
+  // replacements made in the symbols after its operator. These stand in for
+  // the template in the template line
+  auto expand(std::deque<SpecLine> &lines, size_t t,
+              std::map<std::string, std::vector<size_t>, std::less<>> &rules)
+      -> bool {
+    const auto &tokens = lines[t].tokens;
+    auto open = std::find_if(begin(tokens), end(tokens),
+                             [](auto &token) { return token.text == "["; });
+    auto close = std::find_if(open, end(tokens),
+                              [](auto &token) { return token.text == "]"; });
+    if (open == begin(tokens) || isPunctuation((open - 1)->text))
+      return fail(lines[t], *open, "expected a template symbol before [");
+    if (close == end(tokens)) return fail(lines[t], *open, "unclosed [");
+    if (std::any_of(close, end(tokens),
+                    [](auto &token) { return token.text == "["; }))
+      return fail(lines[t], *open, "only one template per line");
+
+    std::map<std::string, std::string> map;
+    if (!replacements(lines[t], open, close, map)) return false;
+
+    auto name = (open - 1)->text;
+    auto it = rules.find(name);
+    if (it == end(rules))
+      return fail(lines[t], *(open - 1), "no rules of " + name + " to expand");
+
+    std::string prefix, suffix;
+    for (auto at = begin(tokens); at != open - 1; ++at)
+      prefix += at->text + " ";
+    for (auto at = close + 1; at != end(tokens); ++at) suffix += " " + at->text;
+
+    // rules expanded from here are not expanded again by this template
+    auto bodies = it->second;
+    for (auto b : bodies) {
+      const auto &body = lines[b];
+      auto op = findOperator(body.tokens);
+      if (op == end(body.tokens))
+        return fail(body, body.tokens[0], "expected >= or ==");
+
+      auto text = body.text.substr(op->column - 1 + 2);
+      for (const auto &[key, value] : map)
+        for (auto p = text.find(key); p != text.npos;
+             p = text.find(key, p + size(value)))
+          text.replace(p, size(key), value);
+
+      SpecLine expanded{prefix + text + suffix, {}, &*(open - 1)};
+      expanded.tokens = lex(expanded.text, open->line);
+      for (auto &token : expanded.tokens) token.column = open->column;
+      rules[expanded.tokens[0].text].push_back(size(lines));
+      lines.push_back(std::move(expanded));
+    }
+    return true;
+  }
+
+  Specification spec = {};
+  std::string error = {};
+};
+
+}  // namespace
+
+auto parseSpec(std::string_view text) -> Expected<Specification> {
+  SpecParser parser;
+  // expansions are appended, so references to lines stay valid
+  std::deque<SpecLine> lines;
+  // rule lines by their symbol, and the lines with a template
+  std::map<std::string, std::vector<size_t>, std::less<>> rules;
+  std::vector<size_t> templates;
+
+  uint32_t number = 0;
+  for (size_t begin = 0; begin <= size(text); ++number) {
+    auto end = std::min(text.find('\n', begin), size(text));
+    auto line = text.substr(begin, end - begin);
+    begin = end + 1;
+
+    auto tokens = lex(line, number + 1);
+    if (tokens.empty() || tokens[0].text[0] == '#') continue;
+    auto isTemplate = std::any_of(tokens.begin(), tokens.end(),
+                                  [](auto &t) { return t.text == "["; });
+    (isTemplate ? templates : rules[tokens[0].text]).push_back(size(lines));
+    lines.push_back({std::string(line), std::move(tokens)});
+  }
+
+  for (auto t : templates)
+    if (!parser.expand(lines, t, rules)) return Error<>(parser.error);
+
+  for (size_t i = 0; i != size(lines); ++i)
+    if (!std::binary_search(templates.begin(), templates.end(), i) &&
+        !parser.rule(lines[i]))
+      return Error<>(parser.error);
+
+  return std::move(parser.spec);
+}
+
+}  // namespace tiny_bnf
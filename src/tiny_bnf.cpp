@@ -1,23 +1,15 @@
-#include <tiny_bnf.h>
+#include <tiny_bnf_internal.h>
 
 #include <algorithm>
 #include <chrono>
-#include <iostream>
+#include <deque>
+#include <limits>
 #include <map>
-#include <regex>
+#include <memory_resource>
+#include <unordered_map>
 
 namespace tiny_bnf {
 
-template <typename It, typename T, typename U, typename F>
-auto accumulateN(It it, T n, U init, F f) {
-  for (T i = 0; i < n; ++i) init = f(init, it++);
-  return init;
-}
-
-inline auto isWord(char c) -> bool {
-  return (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') || c == '_';
-}
-
 auto autoTerminals(const Specification &spec) -> Terminals {
   Terminals terminals;
   std::map<std::string, bool> ts;
@@ -33,402 +25,1517 @@ auto autoTerminals(const Specification &spec) -> Terminals {
   return terminals;
 }
 
+auto autoTerminals(const CompiledGrammar &grammar) -> Terminals {
+  Terminals terminals;
+  for (size_t s = 0; s != size(grammar.symbols); ++s)
+    if (!grammar.isNonTerminal(s)) terminals[grammar.symbols[s]];
+  return terminals;
+}
+
+auto compile(const Terminals &terminals) -> CompiledTerminals {
+  CompiledTerminals dfa;
+  for (const auto &[expr, symbol] : terminals.expr2Sym)
+    for (auto c : expr)
+      if (auto &cls = dfa.classes[uint8_t(c)]; cls == 0) cls = dfa.nClasses++;
+
+  auto state = [&] {
+    dfa.transitions.resize(size(dfa.transitions) + dfa.nClasses,
+                           CompiledTerminals::kDead);
+    dfa.accepts.push_back(-1);
+    return uint32_t(size(dfa.accepts) - 1);
+  };
+  state();
+
+  for (const auto &[expr, symbol] : terminals.expr2Sym) {
+    if (expr.empty()) continue;
+    uint32_t s = 0;
+    for (auto c : expr) {
+      auto t = s * dfa.nClasses + dfa.classes[uint8_t(c)];
+      if (dfa.transitions[t] == CompiledTerminals::kDead) {
+        auto next = state();
+        dfa.transitions[t] = next;
+      }
+      s = dfa.transitions[t];
+    }
+    dfa.accepts[s] = size(dfa.symbols);
+    dfa.symbols.push_back(symbol);
+  }
+
+  // single separator bytes that no longer terminal starts with
+  for (const auto &[expr, symbol] : terminals.expr2Sym) {
+    if (size(expr) != 1 || symbol != "" || isWord(expr[0])) continue;
+    auto s = dfa.next(0, expr[0]);
+    auto out = begin(dfa.transitions) + s * dfa.nClasses;
+    if (std::all_of(out, out + dfa.nClasses, [](auto t) {
+          return t == CompiledTerminals::kDead;
+        }))
+      dfa.skip += expr[0];
+  }
+
+  return dfa;
+}
+
+// Passes the terminal index, start and end of the longest match at each
+// position of `input` to `f`, except for skipped runs. Returns the error, if
+// some input matches no terminal
+template <typename F>
+auto matchTerminals(const CompiledTerminals &terminals, std::string_view input,
+                    bool delimit, F f) -> std::optional<std::string> {
+  size_t a = 0;
+  while (a != size(input)) {
+    if (terminals.skip.find(input[a]) != std::string::npos) {
+      a = scanSkip(input, a, terminals.skip);
+      continue;
+    }
+
+    // the longest match that ends where a word may end. A match that starts
+    // with a word byte can not end before the end of that word
+    auto word = delimit && isWord(input[a]) ? scanWord(input, a) : a;
+    auto boundary = [&](size_t end) {
+      return end >= word && (end == word || end == size(input) ||
+                             !isWord(input[end]) || !isWord(input[a]));
+    };
+
+    size_t end = a;
+    int accept = -1;
+    uint32_t s = 0;
+    for (auto b = a; b != size(input); ++b) {
+      s = terminals.next(s, input[b]);
+      if (s == CompiledTerminals::kDead) break;
+      if (terminals.accepts[s] != -1 && (!delimit || boundary(b + 1))) {
+        end = b + 1;
+        accept = terminals.accepts[s];
+      }
+    }
+
+    if (accept == -1)
+      return "Unable to tokenize: " + (std::string)input.substr(a);
+    if (terminals.symbols[accept] != "") f(accept, a, end);
+    a = end;
+  }
+
+  return std::nullopt;
+}
+
+auto tokenize(const CompiledTerminals &terminals, std::string_view input,
+              bool delimit) -> Expected<Tokens> {
+  Tokens tokens;
+  auto error = matchTerminals(terminals, input, delimit,
+                              [&](int accept, size_t, size_t) {
+                                tokens.push_back(terminals.symbols[accept]);
+                              });
+  if (error) return Error<>(*error);
+  return tokens;
+}
+
 auto tokenize(const Terminals &terminals, std::string_view input, bool delimit)
     -> Expected<Tokens> {
-  Tokens tokens;
-  const auto &map = terminals.expr2Sym;
-
-  auto n =
-      accumulateN(size_t{1}, std::size(input), size_t{0}, [&](auto a, auto b) {
-        if (!delimit || b == size(input) || !isWord(input[b]) ||
-            !isWord(input[a]))
-          if (auto it = map.find(input.substr(a, b - a)); it != std::end(map)) {
-            if (it->second != "") tokens.push_back(it->second);
-            return b;
-          }
-        return a;
-      });
+  return tokenize(compile(terminals), input, delimit);
+}
 
-  if (n == std::size(input))
-    return tokens;
-  else
-    return Error<>("Unable to tokenize: " + (std::string)input.substr(n));
+auto tokenize(const CompiledTerminals &terminals,
+              const CompiledGrammar &grammar, std::string_view input,
+              bool delimit) -> Expected<TokenStream> {
+  std::vector<int> ids;
+  for (const auto &symbol : terminals.symbols)
+    ids.push_back(grammar.id(symbol));
+
+  TokenStream tokens;
+  auto error = matchTerminals(terminals, input, delimit,
+                              [&](int accept, size_t start, size_t end) {
+                                auto text = input.substr(start, end - start);
+                                tokens.push_back({ids[accept], text});
+                              });
+  if (error) return Error<>(*error);
+  return tokens;
 }
 
-template <typename F>
-void traverseNode(Node n, F f) {
-  f(n.symbol);
-  for (auto &r : n.children) traverseNode(r, f);
+void computeFirstSets(CompiledGrammar &g) {
+  auto skippable = [&](const CompiledGrammar::Expr &expr) {
+    return expr.optional || expr.arbitrary || g.nullable[expr.symbol];
+  };
+
+  g.nullable.assign(size(g.symbols), false);
+  for (bool changed = true; changed;) {
+    changed = false;
+    for (auto &rule : g.rules)
+      if (!rule.nullable &&
+          std::all_of(begin(g.exprs) + rule.exprBegin,
+                      begin(g.exprs) + rule.exprEnd, skippable)) {
+        rule.nullable = changed = true;
+        g.nullable[rule.symbol] = true;
+      }
+  }
+
+  // FIRST sets by symbol, a terminal starts with itself
+  auto words = g.firstWords = (size(g.symbols) + 63) / 64;
+  std::vector<uint64_t> first(size(g.symbols) * words);
+  for (size_t s = 0; s != size(g.symbols); ++s)
+    if (!g.isNonTerminal(s)) first[s * words + s / 64] |= uint64_t(1) << s % 64;
+
+  auto unite = [&](uint64_t *dst, const CompiledGrammar::Rule &rule) {
+    bool changed = false;
+    for (auto e = rule.exprBegin; e != rule.exprEnd; ++e) {
+      const auto *src = &first[g.exprs[e].symbol * words];
+      for (size_t w = 0; w != words; ++w)
+        if ((dst[w] | src[w]) != dst[w]) (dst[w] |= src[w], changed = true);
+      if (!skippable(g.exprs[e])) break;
+    }
+    return changed;
+  };
+
+  for (bool changed = true; changed;) {
+    changed = false;
+    for (const auto &rule : g.rules)
+      changed = unite(&first[rule.symbol * words], rule) || changed;
+  }
+
+  g.first.assign(size(g.rules) * words, 0);
+  for (size_t r = 0; r != size(g.rules); ++r)
+    unite(&g.first[r * words], g.rules[r]);
+}
+
+auto compile(const Specification &spec) -> CompiledGrammar {
+  CompiledGrammar grammar;
+
+  auto intern = [&](const std::string &symbol) {
+    auto [it, inserted] = grammar.ids.insert({symbol, size(grammar.symbols)});
+    if (inserted) grammar.symbols.push_back(symbol);
+    return it->second;
+  };
+  for (const auto &rule : spec) intern(rule.symbol);
+  for (const auto &rule : spec)
+    for (const auto &expr : rule.expr) intern(expr.symbol);
+
+  // a provided attribute only matters if it, or the "symbol.attribute" names
+  // it turns into while being merged upwards, is required somewhere
+  std::set<std::string> attributes;
+  for (const auto &rule : spec)
+    for (const auto &expr : rule.expr)
+      for (const auto &a : expr.attribs) {
+        attributes.insert(a);
+        for (auto p = a.find('.'); p != a.npos; p = a.find('.', p + 1))
+          attributes.insert(a.substr(p + 1));
+      }
+
+  std::map<std::string, int, std::less<>> attributeIds;
+  for (const auto &a : attributes) {
+    attributeIds[a] = size(grammar.attributes);
+    grammar.attributes.push_back(a);
+  }
+
+  std::vector<std::vector<std::pair<int, int>>> merges(size(grammar.symbols));
+  for (const auto &[a, id] : attributeIds)
+    for (size_t p = a.find('.'); p != a.npos; p = a.find('.', p + 1))
+      if (auto symbol = grammar.id(std::string_view(a).substr(0, p));
+          symbol != -1)
+        if (auto it = attributeIds.find(std::string_view(a).substr(p + 1));
+            it != end(attributeIds))
+          merges[symbol].push_back({it->second, id});
+
+  for (auto &m : merges) {
+    std::sort(begin(m), end(m));
+    grammar.mergesBegin.push_back(size(grammar.merges));
+    grammar.merges.insert(end(grammar.merges), begin(m), end(m));
+  }
+  grammar.mergesBegin.push_back(size(grammar.merges));
+
+  std::vector<std::vector<uint32_t>> alternatives(size(grammar.symbols));
+  for (const auto &rule : spec) {
+    CompiledGrammar::Rule r;
+    r.symbol = grammar.id(rule.symbol);
+    r.idx = rule.idx;
+    r.intermediate = rule.intermediate;
+    r.alias = rule.alias;
+
+    r.exprBegin = size(grammar.exprs);
+    for (const auto &expr : rule.expr) {
+      CompiledGrammar::Expr e;
+      e.symbol = grammar.id(expr.symbol);
+      e.optional = expr.optional;
+      e.arbitrary = expr.arbitrary;
+      e.oneOrMore = expr.oneOrMore;
+      e.deref = expr.deref;
+      e.attribsBegin = size(grammar.attribs);
+      for (const auto &a : expr.attribs)
+        grammar.attribs.push_back(attributeIds[a]);
+      e.attribsEnd = size(grammar.attribs);
+      grammar.exprs.push_back(e);
+    }
+    r.exprEnd = size(grammar.exprs);
+
+    // std::set keeps the provided attributes sorted by name, and so by id
+    r.attribsBegin = size(grammar.attribs);
+    for (const auto &a : rule.attributes)
+      if (auto it = attributeIds.find(a); it != end(attributeIds))
+        grammar.attribs.push_back(it->second);
+    r.attribsEnd = size(grammar.attribs);
+
+    alternatives[r.symbol].push_back(size(grammar.rules));
+    grammar.rules.push_back(r);
+  }
+
+  for (auto &a : alternatives) {
+    grammar.alternativesBegin.push_back(size(grammar.alternatives));
+    grammar.alternatives.insert(end(grammar.alternatives), begin(a), end(a));
+  }
+  grammar.alternativesBegin.push_back(size(grammar.alternatives));
+
+  if (size(grammar.rules)) grammar.start = grammar.rules.front().symbol;
+
+  computeFirstSets(grammar);
+  grammar.tables = std::make_shared<detail::Tables>();
+
+  return grammar;
+}
+
+namespace detail {
+
+auto makeTables() -> std::shared_ptr<Tables> {
+  return std::make_shared<Tables>();
+}
+
+}  // namespace detail
+
+auto expand(const CompiledGrammar &g) -> Bnf {
+  Bnf bnf;
+  bnf.generatedBegin = bnf.symbols = size(g.symbols);
+  bnf.alternatives.resize(size(g.symbols));
+
+  auto add = [&](Bnf::Production production) {
+    bnf.alternatives[production.symbol].push_back(size(bnf.productions));
+    bnf.productions.push_back(std::move(production));
+  };
+
+  for (uint32_t r = 0; r != size(g.rules); ++r) {
+    const auto &rule = g.rules[r];
+    Bnf::Production production{rule.symbol, r};
+
+    for (auto e = rule.exprBegin; e != rule.exprEnd; ++e) {
+      const auto &expr = g.exprs[e];
+      auto symbol = expr.symbol;
+
+      // X? -> N := | X, X* -> N := | N X, X+ -> N := X | N X
+      if (expr.optional || expr.arbitrary || expr.oneOrMore) {
+        symbol = bnf.symbols++;
+        bnf.alternatives.emplace_back();
+        auto empty = expr.optional || expr.arbitrary;
+        auto repeats = expr.arbitrary || expr.oneOrMore;
+        if (empty) add({symbol, r, true});
+        if (!empty || !repeats) add({symbol, r, true, {expr.symbol}, {e}});
+        if (repeats)
+          add({symbol, r, true, {symbol, expr.symbol}, {e, e}});
+      }
+
+      production.rhs.push_back(symbol);
+      production.exprs.push_back(e);
+    }
+
+    add(std::move(production));
+  }
+
+  bnf.nullable.assign(bnf.symbols, false);
+  for (bool changed = true; changed;) {
+    changed = false;
+    for (const auto &p : bnf.productions)
+      if (!bnf.nullable[p.symbol] &&
+          std::all_of(begin(p.rhs), end(p.rhs),
+                      [&](int s) { return bnf.nullable[s]; }))
+        bnf.nullable[p.symbol] = changed = true;
+  }
+
+  return bnf;
+}
+
+// An Earley item is a rule with a dot position and an origin. How the item
+// was reached is not stored in the item itself but as a list of links
+struct Item {
+  uint32_t rule = 0;
+  uint32_t dot = 0;
+  uint32_t origin = 0;
+  uint32_t attributes = 0;
+  // the oneOrMore expr at dot has been matched once and now acts as arbitrary
+  bool looped = false;
+  // the item was predicted, so its derivations include the empty one
+  bool predicted = false;
+  uint32_t firstLink = kNone;
+  uint32_t lastLink = kNone;
+};
+
+struct ItemKey {
+  uint32_t rule, dot, origin, attributes;
+  bool looped;
+
+  auto operator==(const ItemKey &rhs) const {
+    return rule == rhs.rule && dot == rhs.dot && origin == rhs.origin &&
+           attributes == rhs.attributes && looped == rhs.looped;
+  }
+};
+
+struct ItemKeyHash {
+  auto operator()(const ItemKey &key) const {
+    auto h = uint64_t(key.rule) * 0x9E3779B97F4A7C15ull;
+    h ^= (uint64_t(key.dot) << 32 | key.origin) + (h << 6) + (h >> 2);
+    h ^= (uint64_t(key.attributes) << 1 | key.looped) + (h << 6) + (h >> 2);
+    return size_t(h);
+  }
+};
+
+auto key(const Item &item) {
+  return ItemKey{item.rule, item.dot, item.origin, item.attributes,
+                 item.looped};
 }
 
-struct State {
-  size_t i = 0;
-  size_t p = 0;
-  Rule rule;
-  Node node;
-  size_t start = 0;
+// One way an item was reached from item `pred` of set `predSet`: by skipping
+// an optional or arbitrary expr, by scanning the token preceding the item's
+// set, or by completing item `child` of the item's set. A Leo link completes
+// `child` into `pred` and then follows the deterministic reduction path
+// memoized in `predSet` up to the item it links
+struct Link {
+  enum Kind : uint8_t { Skip, Scan, Complete, Leo };
+
+  Kind kind = Skip;
+  uint32_t predSet = 0;
+  uint32_t pred = 0;
+  uint32_t child = kNone;
+  uint32_t next = kNone;
+};
+
+// Topmost item of the deterministic reduction path that starts by completing
+// the only item `waiter` of a set that waits for a given symbol. `chained` is
+// set if the path goes on in the origin set of `waiter`
+struct LeoEntry {
+  uint32_t waiter = kNone;
+  Item top;
+  bool chained = false;
+};
+
+struct StateSet {
+  explicit StateSet(std::pmr::memory_resource *memory)
+      : items(memory),
+        links(memory),
+        index(memory),
+        waiting(memory),
+        empty(memory),
+        leo(memory) {}
+
+  std::pmr::vector<Item> items;
+  std::pmr::vector<Link> links;
+  std::pmr::unordered_map<ItemKey, uint32_t, ItemKeyHash> index;
+  // (next symbol, item) of processed incomplete items, sorted by symbol once
+  // the set is done
+  std::pmr::vector<std::pair<int, uint32_t>> waiting;
+  // processed complete items that also start in this set
+  std::pmr::vector<uint32_t> empty;
+  // Leo entries by symbol, computed on first use once the set is done
+  std::pmr::map<int, LeoEntry> leo;
 };
-using StateSets = std::vector<std::vector<State>>;
-
-auto isComplete(const State &state) { return state.p == size(state.rule.expr); }
-
-auto match(const State &state, const Rule &r) {
-  if (isComplete(state)) return false;
-  for (auto &a : state.rule.expr[state.p].attribs)
-    if (r.attributes.find(a) == end(r.attributes)) return false;
-  return state.rule.expr[state.p].symbol == r.symbol;
-}
-
-auto predict(StateSets &stateSets, size_t k, size_t i, const Expr &next,
-             const std::map<std::string, std::vector<Rule>> &rules,
-             std::vector<bool> &addedRules) {
-  auto it = rules.find(next.symbol);
-  if (it == end(rules)) return false;
-  for (auto &rule : it->second)
-    if (!addedRules[rule.idx]) {
-      stateSets[k].push_back(State{k, 0, rule, {rule.symbol, {}}, i});
-      addedRules[rule.idx] = true;
+
+// sets are moved whenever the chart grows
+static_assert(std::is_nothrow_move_constructible_v<StateSet>);
+
+struct Chart {
+  const CompiledGrammar &grammar;
+  // memory of the sets, which is released at once with the chart
+  std::unique_ptr<std::pmr::memory_resource> memory = {};
+  std::vector<int> tokens = {};
+  std::vector<StateSet> sets = {};
+  AttributeSets attributes = {};
+  std::vector<uint32_t> ruleAttributes = {};
+  // one past the index of the set in which each symbol was last predicted
+  std::vector<size_t> predicted = {};
+  bool leo = true;
+  bool lookahead = true;
+  // threads that share the work on large sets, if any
+  WorkerPool *pool = nullptr;
+  // receives the statistics of each set, which add up in `stats`
+  ParseObserver *observer = nullptr;
+  ParseStats stats = {};
+  // the work on the last set by rule, if the observer profiles rules
+  std::vector<RuleStats> rules = {};
+};
+
+// items of a set that are worth processing with more than one thread
+constexpr size_t kParallelWave = 512;
+
+// grows or shrinks the chart to `n` sets
+void resize(Chart &chart, size_t n) {
+  chart.sets.erase(chart.sets.begin() + std::min(n, size(chart.sets)),
+                   chart.sets.end());
+  while (size(chart.sets) < n) chart.sets.emplace_back(chart.memory.get());
+}
+
+auto isComplete(const CompiledGrammar &g, const Item &item) {
+  return item.dot == g.size(g.rules[item.rule]);
+}
+
+auto next(const CompiledGrammar &g, const Item &item) -> auto & {
+  return g.exprs[g.rules[item.rule].exprBegin + item.dot];
+}
+
+auto isArbitrary(const CompiledGrammar &g, const Item &item) {
+  return next(g, item).arbitrary || item.looped;
+}
+
+auto add(Chart &chart, size_t k, const Item &item) -> uint32_t {
+  auto &set = chart.sets[k];
+  auto [it, inserted] = set.index.insert({key(item), size(set.items)});
+  if (inserted) set.items.push_back(item);
+  return it->second;
+}
+
+void link(Chart &chart, size_t k, const Item &item, Link link) {
+  auto &set = chart.sets[k];
+  auto i = add(chart, k, item);
+  auto l = uint32_t(size(set.links));
+  set.links.push_back(link);
+  if (set.items[i].lastLink != kNone)
+    set.links[set.items[i].lastLink].next = l;
+  else
+    set.items[i].firstLink = l;
+  set.items[i].lastLink = l;
+}
+
+// item `w` with the dot moved over one match of its next expr
+auto advance(const CompiledGrammar &g, Item w, uint32_t attributes) {
+  const auto &expr = next(g, w);
+  w.attributes = attributes;
+  w.looped = w.looped || expr.oneOrMore;
+  if (!expr.arbitrary && !w.looped) w.dot += 1;
+  w.predicted = false;
+  w.firstLink = w.lastLink = kNone;
+  return w;
+}
+
+auto predict(Chart &chart, size_t k, int symbol) {
+  const auto &g = chart.grammar;
+  if (chart.predicted[symbol] == k + 1) return;
+  chart.predicted[symbol] = k + 1;
+
+  // rules that can neither start with the next token nor be empty could not
+  // scan or complete anyway
+  auto token = k != size(chart.tokens) ? chart.tokens[k] : -1;
+  for (auto a = g.alternativesBegin[symbol];
+       a != g.alternativesBegin[symbol + 1]; ++a) {
+    auto r = g.alternatives[a];
+    if (chart.lookahead && !g.rules[r].nullable &&
+        (token == -1 || !g.startsWith(r, token)))
+      continue;
+    if (chart.ruleAttributes[r] == kNone)
+      chart.ruleAttributes[r] = chart.attributes.intern(
+          {begin(g.attribs) + g.rules[r].attribsBegin,
+           begin(g.attribs) + g.rules[r].attribsEnd});
+    auto i = add(chart, k, Item{r, 0, uint32_t(k), chart.ruleAttributes[r]});
+    chart.sets[k].items[i].predicted = true;
+  }
+}
+
+// processed items of the done set `set` that wait for `symbol`
+auto waiters(const StateSet &set, int symbol) {
+  return std::equal_range(
+      begin(set.waiting), end(set.waiting), std::pair{symbol, uint32_t(0)},
+      [](auto &a, auto &b) { return a.first < b.first; });
+}
+
+auto leoEntry(Chart &chart, size_t o, int symbol) -> const LeoEntry * {
+  const auto &g = chart.grammar;
+  auto &set = chart.sets[o];
+  if (auto it = set.leo.find(symbol); it != end(set.leo))
+    return it->second.waiter != kNone ? &it->second : nullptr;
+  // an entry without waiter also stands for one that is being computed
+  auto &entry = set.leo[symbol];
+
+  auto [first, last] = waiters(set, symbol);
+  if (last - first != 1) return nullptr;
+
+  // the path has to be deterministic regardless of the completed item, so
+  // the waiter can neither require nor inherit attributes
+  auto waiter = set.items[first->second];
+  const auto &expr = next(g, waiter);
+  if (expr.attribsBegin != expr.attribsEnd ||
+      g.mergesBegin[symbol] != g.mergesBegin[symbol + 1] || expr.arbitrary ||
+      expr.oneOrMore || waiter.looped ||
+      waiter.dot + 1 != g.size(g.rules[waiter.rule]))
+    return nullptr;
+
+  auto top = advance(g, waiter, waiter.attributes);
+  auto lhs = g.rules[top.rule].symbol;
+  bool chained = false;
+
+  // complete top items have to stay in the chart
+  if (top.origin != 0 || lhs != g.start)
+    if (auto next = leoEntry(chart, top.origin, lhs)) {
+      top = next->top;
+      chained = true;
     }
+
+  entry = LeoEntry{first->second, top, chained};
+  return &entry;
+}
+
+// whether `completed` has the attributes that the next expr of `waiter`
+// requires
+auto satisfies(const Chart &chart, const Item &waiter, const Item &completed) {
+  const auto &g = chart.grammar;
+  const auto &expr = next(g, waiter);
+  for (auto a = expr.attribsBegin; a != expr.attribsEnd; ++a)
+    if (!chart.attributes.contains(completed.attributes, g.attribs[a]))
+      return false;
   return true;
 }
 
-auto scan(StateSets &stateSets, size_t k, const Expr &next, State s) {
-  if (!s.rule.expr[s.p].arbitrary) s.p += 1;
-  s.node.children.push_back(Node{next.symbol, {}});
-  stateSets[k + 1].push_back(s);
+// complete item `w` of set `o` with the complete item `c` of set `k`, which
+// satisfies its requirements
+auto complete(Chart &chart, size_t k, size_t o, uint32_t w, uint32_t c) {
+  const auto &g = chart.grammar;
+  auto waiter = chart.sets[o].items[w];
+  auto completed = chart.sets[k].items[c];
+  const auto &expr = next(g, waiter);
+
+  auto attributes = chart.attributes.merge(g, waiter.attributes, expr.symbol,
+                                           completed.attributes);
+  link(chart, k, advance(g, waiter, attributes),
+       Link{Link::Complete, uint32_t(o), w, c});
 }
 
-auto complete(StateSets &stateSets, size_t k, size_t i) {
-  auto sz = size(stateSets[stateSets[k][i].i]);
-  for (size_t j = stateSets[k][i].start; j < sz; ++j)
-    if (match(stateSets[stateSets[k][i].i][j], stateSets[k][i].rule)) {
-      auto sc = stateSets[stateSets[k][i].i][j];
+// items of the done set `o` that the complete item `i` of set `k` completes
+auto completes(const Chart &chart, size_t k, uint32_t i)
+    -> std::vector<uint32_t> {
+  const auto &g = chart.grammar;
+  const auto &item = chart.sets[k].items[i];
+  std::vector<uint32_t> result;
+  if (!isComplete(g, item) || item.origin == k) return result;
+
+  const auto &origin = chart.sets[item.origin];
+  auto [first, last] = waiters(origin, g.rules[item.rule].symbol);
+  for (auto it = first; it != last; ++it)
+    if (satisfies(chart, origin.items[it->second], item))
+      result.push_back(it->second);
+  return result;
+}
 
-      if (sc.rule.expr[sc.p].oneOrMore) {
-        sc.rule.expr[sc.p].oneOrMore = false;
-        sc.rule.expr[sc.p].arbitrary = true;
+// processes item `i` of set `k`. `completed` holds the items it completes
+// in an earlier set, if they were looked up beforehand
+void process(Chart &chart, size_t k, uint32_t i,
+             const std::vector<uint32_t> *completed = nullptr) {
+  const auto &g = chart.grammar;
+  auto item = chart.sets[k].items[i];
+
+  if (!isComplete(g, item)) {
+    const auto &next = tiny_bnf::next(g, item);
+    chart.sets[k].waiting.push_back({next.symbol, i});
+
+    if (g.isNonTerminal(next.symbol)) {
+      // prediction
+      predict(chart, k, next.symbol);
+
+      // complete with empty derivations that were already processed
+      for (size_t j = 0; j < size(chart.sets[k].empty); ++j) {
+        auto c = chart.sets[k].empty[j];
+        if (g.rules[chart.sets[k].items[c].rule].symbol == next.symbol &&
+            satisfies(chart, item, chart.sets[k].items[c]))
+          complete(chart, k, k, i, c);
       }
+    } else if (k != size(chart.tokens) && chart.tokens[k] == next.symbol) {
+      // scanning
+      link(chart, k + 1, advance(g, item, item.attributes),
+           Link{Link::Scan, uint32_t(k), i});
+    }
 
-      if (stateSets[k][i].rule.intermediate || sc.rule.alias ||
-          sc.rule.expr[sc.p].deref) {
-        for (auto &n : stateSets[k][i].node.children)
-          sc.node.children.push_back(n);
-      } else {
-        sc.node.children.push_back(stateSets[k][i].node);
+    if (next.optional || isArbitrary(g, item)) {
+      auto skipped = advance(g, item, item.attributes);
+      skipped.dot = item.dot + 1;
+      skipped.looped = false;
+      link(chart, k, skipped, Link{Link::Skip, uint32_t(k), i});
+    }
+  } else {
+    // completion
+    auto symbol = g.rules[item.rule].symbol;
+    auto &origin = chart.sets[item.origin];
+
+    if (item.origin == k) {
+      chart.sets[k].empty.push_back(i);
+      for (size_t j = 0; j < size(origin.waiting); ++j) {
+        auto w = origin.waiting[j].second;
+        if (origin.waiting[j].first == symbol &&
+            satisfies(chart, origin.items[w], item))
+          complete(chart, k, k, w, i);
       }
+    } else if (auto entry = chart.leo ? leoEntry(chart, item.origin, symbol)
+                                      : nullptr) {
+      link(chart, k, entry->top,
+           Link{Link::Leo, item.origin, entry->waiter, i});
+    } else if (completed) {
+      for (auto w : *completed) complete(chart, k, item.origin, w, i);
+    } else {
+      auto [first, last] = waiters(origin, symbol);
+      for (auto it = first; it != last; ++it)
+        if (satisfies(chart, origin.items[it->second], item))
+          complete(chart, k, item.origin, it->second, i);
+    }
+  }
+}
 
-      mergeAttributes(sc.rule, stateSets[k][i].rule);
+using Clock = std::chrono::steady_clock;
 
-      if (!sc.rule.expr[sc.p].arbitrary) sc.p += 1;
+auto seconds(Clock::time_point since) {
+  return std::chrono::duration<double>(Clock::now() - since).count();
+}
 
-      stateSets[k].push_back(std::move(sc));
+// passes the statistics of the processed set `k`, which took `seconds`, to
+// the observer
+void observe(Chart &chart, size_t k, double seconds) {
+  const auto &set = chart.sets[k];
+  SetStats stats{k, size(set.items)};
+  stats.seconds = seconds;
+  size_t derived = 0;
+  for (const auto &item : set.items) {
+    stats.predictions += item.predicted;
+    derived += item.firstLink != kNone && !item.predicted;
+  }
+  for (const auto &link : set.links) {
+    stats.scans += link.kind == Link::Scan;
+    stats.completions += link.kind == Link::Complete || link.kind == Link::Leo;
+  }
+  // the first derivation of an item is the one that added it, unless it was
+  // predicted
+  stats.duplicates = size(set.links) - derived;
+
+  if (chart.observer->profilesRules()) {
+    chart.rules.assign(size(chart.grammar.rules), RuleStats{});
+    for (const auto &item : set.items) chart.rules[item.rule].items += 1;
+    for (const auto &link : set.links)
+      if (link.kind == Link::Complete || link.kind == Link::Leo)
+        chart.rules[set.items[link.child].rule].completions += 1;
+    stats.rules = chart.rules.data();
+  }
+  chart.observer->onSet(stats);
+
+  auto &total = chart.stats;
+  total.sets += 1;
+  total.items += stats.items;
+  total.predictions += stats.predictions;
+  total.scans += stats.scans;
+  total.completions += stats.completions;
+  total.duplicates += stats.duplicates;
+}
+
+// processes the items of set `k`, which scan token `k` if it is known
+void process(Chart &chart, size_t k) {
+  auto start = chart.observer ? Clock::now() : Clock::time_point();
+  auto &set = chart.sets[k];
+  for (uint32_t i = 0; i < size(set.items);) {
+    // the items known so far look up the items they complete in earlier sets
+    // in parallel, which only reads the chart. They are then processed one
+    // by one as usual, so the chart is the same as with one thread
+    std::vector<std::vector<uint32_t>> completed;
+    auto wave = uint32_t(size(set.items));
+    if (chart.pool && wave - i >= kParallelWave) {
+      completed.resize(wave - i);
+      chart.pool->run(wave - i, [&, first = i](size_t j) {
+        completed[j] = completes(chart, k, first + j);
+      });
+    } else {
+      wave = i + 1;
     }
+
+    for (auto first = i; i != wave; ++i)
+      process(chart, k, i, size(completed) ? &completed[i - first] : nullptr);
+  }
+
+  if (chart.observer) observe(chart, k, seconds(start));
+
+  std::stable_sort(begin(set.waiting), end(set.waiting),
+                   [](auto &a, auto &b) { return a.first < b.first; });
+  set.index = {};
+  set.empty = {};
 }
 
-auto parseEarley(Specification spec, Tokens tokens)
-    -> Expected<std::vector<Node>> {
-  auto t0 = std::chrono::high_resolution_clock::now();
-  auto stateSets = StateSets(size(tokens) + 1);
-  for (size_t i = 0; i != size(spec.rules); ++i)
-    if (spec.rules[i].symbol == spec.rules[0].symbol)
-      stateSets[0].push_back(
-          State{0, 0, spec.rules[i], Node{spec.rules[i].symbol, {}}});
-
-  std::map<std::string, std::vector<Rule>> rules;
-  for (auto &rule : spec) rules[rule.symbol].push_back(rule);
-  std::vector<bool> addedRules(size(spec.rules));
-
-  for (size_t k = 0; k <= size(tokens); ++k) {
-    for (size_t i = 0; i < size(stateSets[k]); ++i) {
-      auto show = [&](auto &s) {
-        if (i == 0) std::cout << "\n";
-        std::cout << s.i << ' ' << s.rule.symbol << " → ";
-        for (size_t j = 0; j < s.p; j++)
-          std::cout << s.rule.expr[j].symbol << ' ';
-        std::cout << u8"• ";
-        for (size_t j = s.p; j < size(s.rule.expr); j++)
-          std::cout << s.rule.expr[j].symbol << ' ';
-        std::cout << '\n';
-      };
-      if (0) show(stateSets[k][i]);
-
-      if (!isComplete(stateSets[k][i])) {
-        auto s = stateSets[k][i];
-        const auto &next = s.rule.expr[s.p];
-
-        // prediction
-        auto isNonTerminal = predict(stateSets, k, i, next, rules, addedRules);
-
-        // scanning
-        if (k != size(tokens) && !isNonTerminal && tokens[k] == next.symbol)
-          scan(stateSets, k, next, s);
-
-        if (next.optional || next.arbitrary) {
-          s.p += 1;
-          stateSets[k].push_back(std::move(s));
-        }
+// scans token `k` with the items of set `k`, which was processed before the
+// token was known
+void scan(Chart &chart, size_t k) {
+  const auto &g = chart.grammar;
+  auto token = chart.tokens[k];
+  if (token == -1 || g.isNonTerminal(token)) return;
+
+  auto [first, last] = waiters(chart.sets[k], token);
+  for (auto it = first; it != last; ++it) {
+    auto item = chart.sets[k].items[it->second];
+    link(chart, k + 1, advance(g, item, item.attributes),
+         Link{Link::Scan, uint32_t(k), it->second});
+  }
+}
+
+// Passes allocations on to `upstream` and counts the bytes they take
+struct CountingResource : std::pmr::memory_resource {
+  explicit CountingResource(std::pmr::memory_resource *upstream)
+      : upstream(upstream) {}
+
+  auto do_allocate(size_t n, size_t alignment) -> void * override {
+    bytes += n;
+    return upstream->allocate(n, alignment);
+  }
+  void do_deallocate(void *p, size_t n, size_t alignment) override {
+    upstream->deallocate(p, n, alignment);
+  }
+  auto do_is_equal(const std::pmr::memory_resource &other) const noexcept
+      -> bool override {
+    return this == &other;
+  }
+
+  std::pmr::memory_resource *upstream;
+  size_t bytes = 0;
+};
+
+auto makeChart(const CompiledGrammar &g, const ParseOptions &options,
+               std::unique_ptr<std::pmr::memory_resource> memory) -> Chart {
+  Chart chart{g, std::move(memory)};
+  chart.leo = options.leo;
+  chart.lookahead = options.lookahead;
+  chart.observer = options.observer;
+  chart.ruleAttributes.resize(size(g.rules), kNone);
+  chart.predicted.resize(size(g.symbols));
+  return chart;
+}
 
+auto recognize(const CompiledGrammar &g, const TokenStream &tokens,
+               const ParseOptions &options) -> Chart {
+  // the chart of a whole input is built at once, so nothing it allocates is
+  // released before it
+  auto chart = makeChart(
+      g, options,
+      std::make_unique<std::pmr::monotonic_buffer_resource>(
+          options.memory ? options.memory : std::pmr::get_default_resource()));
+  for (const auto &token : tokens) chart.tokens.push_back(token.symbol);
+  resize(chart, size(tokens) + 1);
+
+  std::optional<WorkerPool> pool;
+  if (options.threads > 1) chart.pool = &pool.emplace(options.threads);
+
+  predict(chart, 0, g.start);
+  for (size_t k = 0; k <= size(tokens); ++k) process(chart, k);
+
+  chart.pool = nullptr;
+  return chart;
+}
+
+// Collects the symbol and packed nodes reachable from the complete top items
+// of a chart
+struct ForestBuilder : ForestWriter {
+  // symbol node of the complete item `i` of set `k`
+  auto symbolNode(size_t k, uint32_t i) -> uint32_t {
+    const auto &item = chart.sets[k].items[i];
+    auto n = node(chart.grammar.rules[item.rule].symbol, item.origin, k, false);
+    if (expanded.insert({k, i}).second) addFamilies(n, sequences(k, i));
+    return n;
+  }
+
+  // whether the children of a complete `rule` are inlined into `pred`
+  auto splices(const Item &pred, uint32_t rule) const {
+    const auto &g = chart.grammar;
+    return g.rules[rule].intermediate || g.rules[pred.rule].alias ||
+           next(g, pred).deref;
+  }
+
+  static void append(Sequences &result, const Sequences &prefixes,
+                     const Sequences &children) {
+    for (const auto &prefix : prefixes)
+      for (const auto &c : children) {
+        auto seq = prefix;
+        seq.insert(end(seq), begin(c), end(c));
+        result.push_back(std::move(seq));
+      }
+  }
+
+  static void append(Sequences &result, const Sequences &prefixes,
+                     uint32_t n) {
+    for (auto seq : prefixes) {
+      seq.push_back(n);
+      result.push_back(std::move(seq));
+    }
+  }
+
+  // sequences of the item a Leo link points to, rebuilt by completing the
+  // items along the memoized path one at a time
+  void appendLeo(Sequences &result, size_t k, const Link &link) {
+    const auto &g = chart.grammar;
+    auto o = link.predSet;
+    auto symbol = g.rules[chart.sets[k].items[link.child].rule].symbol;
+
+    Sequences seqs;
+    auto waiter = chart.sets[o].items[link.pred];
+    if (splices(waiter, chart.sets[k].items[link.child].rule))
+      append(seqs, sequences(o, link.pred), sequences(k, link.child));
+    else
+      append(seqs, sequences(o, link.pred), symbolNode(k, link.child));
+
+    for (auto entry = &chart.sets[o].leo.at(symbol); entry->chained;) {
+      symbol = g.rules[waiter.rule].symbol;
+      auto start = waiter.origin;
+      entry = &chart.sets[start].leo.at(symbol);
+
+      Sequences completed;
+      auto rule = waiter.rule;
+      waiter = chart.sets[start].items[entry->waiter];
+      if (splices(waiter, rule)) {
+        append(completed, sequences(start, entry->waiter), seqs);
       } else {
-        // completion
-        // show(stateSets[k][i]);
-        complete(stateSets, k, i);
-        addedRules[stateSets[k][i].rule.idx] = false;
+        auto n = node(symbol, start, k, false);
+        addFamilies(n, seqs);
+        append(completed, sequences(start, entry->waiter), n);
       }
+      seqs = std::move(completed);
     }
 
-    addedRules.clear();
-    addedRules.resize(size(spec.rules));
+    result.insert(end(result), begin(seqs), end(seqs));
   }
 
-  std::vector<Node> nodes;
-  bool any = false;
+  // children sequences of the derivations of item `i` of set `k`, with the
+  // children of spliced (intermediate, alias or deref) nodes inlined
+  auto sequences(size_t k, uint32_t i) -> const Sequences & {
+    static const Sequences none;
+    if (auto it = memo.find({k, i}); it != end(memo)) return it->second;
+    if (!active.insert({k, i}).second) return none;
+
+    const auto &item = chart.sets[k].items[i];
+    Sequences result;
+    if (item.predicted) result.push_back({});
+
+    for (auto l = item.firstLink; l != kNone; l = chart.sets[k].links[l].next) {
+      auto link = chart.sets[k].links[l];
+      if (link.kind == Link::Leo) {
+        appendLeo(result, k, link);
+        continue;
+      }
 
-  for (auto &s : stateSets.back())
-    if (s.i == 0 && s.node.symbol == spec.rules.front().symbol) {
-      if (isComplete(s) &&
-          std::find(begin(nodes), end(nodes), s.node) == end(nodes))
-        nodes.push_back(s.node);
-      any = true;
+      const auto &pred = chart.sets[link.predSet].items[link.pred];
+      const auto &prefixes = sequences(link.predSet, link.pred);
+
+      if (link.kind == Link::Skip) {
+        result.insert(end(result), begin(prefixes), end(prefixes));
+      } else if (link.kind == Link::Scan) {
+        auto leaf = node(chart.tokens[k - 1], k - 1, k, true);
+        for (auto seq : prefixes) {
+          seq.push_back(leaf);
+          result.push_back(std::move(seq));
+        }
+      } else {
+        if (splices(pred, chart.sets[k].items[link.child].rule))
+          append(result, prefixes, sequences(k, link.child));
+        else
+          append(result, prefixes, symbolNode(k, link.child));
+      }
     }
 
-   auto t1 = std::chrono::high_resolution_clock::now();
-   std::cout << std::chrono::duration<float>(t1 - t0).count() << "\n";
+    active.erase({k, i});
+    return memo[{k, i}] = std::move(result);
+  }
+
+  const Chart &chart;
+  std::pmr::set<std::pair<size_t, uint32_t>> expanded{&memory};
+  std::pmr::map<std::pair<size_t, uint32_t>, Sequences> memo{&memory};
+  std::pmr::set<std::pair<size_t, uint32_t>> active{&memory};
+};
+
+auto buildForest(const Chart &chart) -> Expected<Forest> {
+  const auto &g = chart.grammar;
+  ForestBuilder builder{{}, chart};
+  builder.forest.grammar = &g;
+  bool any = false, complete = false;
+
+  const auto &last = chart.sets.back();
+  for (uint32_t i = 0; i != size(last.items); ++i) {
+    const auto &s = last.items[i];
+    if (s.origin == 0 && g.rules[s.rule].symbol == g.start) {
+      if (isComplete(g, s)) {
+        builder.forest.root = builder.symbolNode(size(chart.sets) - 1, i);
+        complete = true;
+      }
+      any = true;
+    }
+  }
 
-  if (size(nodes) == 0)
+  if (!complete)
     return Error<>(any ? "top node is not complete" : "no top node is parsed");
 
-  return nodes;
+  builder.finish();
+  return std::move(builder.forest);
 }
 
-auto parse(const Specification &spec, Tokens tokens, ParserType parserType)
-    -> Expected<std::vector<Node>> {
-  if (0) {
-    for (auto r : spec) {
-      std::cout << r.symbol << " ::= ";
-      for (auto e : r.expr) {
-        std::cout << e.symbol;
-        if (e.optional) std::cout << "?";
-        if (e.arbitrary) std::cout << "*";
-        if (e.oneOrMore) std::cout << "+";
-        if (e.deref) std::cout << "&";
-        std::cout << " ";
-      }
-      std::cout << "\n";
+struct TreeEnumerator {
+  // passes each tree of symbol node `n` to `f`, returns false once `f` did
+  auto trees(uint32_t n, const std::function<bool(Node &&)> &f) -> bool {
+    const auto &node = forest.nodes[n];
+    const auto &symbol = forest.grammar->symbols[node.symbol];
+    if (node.leaf) {
+      auto text = size(forest.text) ? forest.text[node.start] : "";
+      return f(Node{symbol, {}, text, node.symbol});
     }
-    abort();
+
+    // a node can not be its own descendant, which cuts cyclic derivations
+    if (active[n]) return true;
+    active[n] = true;
+
+    std::vector<Node> children;
+    bool more = true;
+    for (auto p = node.familiesBegin; more && p != node.familiesEnd; ++p)
+      more = sequences(p, 0, children, [&](std::vector<Node> &c) {
+        active[n] = false;
+        auto more = f(Node{symbol, c, span(c), node.symbol});
+        active[n] = true;
+        return more;
+      });
+
+    active[n] = false;
+    return more;
   }
 
-  switch (parserType) {
-    case ParserType::Earley:
-      return parseEarley(spec, std::move(tokens));
-    default:
-      return Error<>("Invalid parser type");
+  auto sequences(uint32_t p, uint32_t i, std::vector<Node> &children,
+                 const std::function<bool(std::vector<Node> &)> &f) -> bool {
+    const auto &family = forest.families[p];
+    if (family.childrenBegin + i == family.childrenEnd) return f(children);
+
+    return trees(forest.children[family.childrenBegin + i], [&](Node &&node) {
+      children.push_back(std::move(node));
+      auto more = sequences(p, i + 1, children, f);
+      children.pop_back();
+      return more;
+    });
+  }
+
+  const Forest &forest;
+  std::vector<bool> active;
+};
+
+void forEachTree(const Forest &forest,
+                 const std::function<bool(const Node &)> &f) {
+  if (size(forest.nodes) == 0) return;
+  TreeEnumerator enumerator{forest, std::vector<bool>(size(forest.nodes))};
+  enumerator.trees(forest.root, [&](Node &&node) { return f(node); });
+}
+
+// all trees of `forest`, which are distinct by construction
+auto trees(const Forest &forest) -> std::vector<Node> {
+  std::vector<Node> nodes;
+  if (size(forest.nodes) == 0) return nodes;
+  TreeEnumerator enumerator{forest, std::vector<bool>(size(forest.nodes))};
+  enumerator.trees(forest.root, [&](Node &&node) {
+    nodes.push_back(std::move(node));
+    return true;
+  });
+  return nodes;
+}
+
+// tokens of `g` with no text, but for those `g` does not know
+auto intern(const CompiledGrammar &g, const Tokens &tokens) -> TokenStream {
+  TokenStream stream;
+  for (const auto &token : tokens) {
+    auto id = g.id(token);
+    stream.push_back({id, id == -1 ? std::string_view(token) : ""});
   }
+  return stream;
 }
 
-auto generateImpl(const Generator &generator, const Node &node)
-    -> Expected<std::pair<AnnotatedPtr, Generator::Concept *>> {
-  using R = Expected<std::pair<AnnotatedPtr, Generator::Concept *>>;
+// the forest of `tokens`, with what it took to build it in `stats` if there
+// is an observer
+auto earleyForest(const CompiledGrammar &g, const TokenStream &tokens,
+                  ParseOptions options, ParseStats &stats)
+    -> Expected<Forest> {
+  if (g.start == -1) return Error<>("empty specification");
+  // outlives the chart, which is destroyed first
+  std::optional<CountingResource> counter;
+  if (options.observer)
+    options.memory = &counter.emplace(
+        options.memory ? options.memory : std::pmr::get_default_resource());
+
+  auto start = options.observer ? Clock::now() : Clock::time_point();
+  auto chart = recognize(g, tokens, options);
+  if (options.observer) {
+    stats = chart.stats;
+    stats.tokens = size(tokens);
+    stats.chartBytes = counter->bytes;
+    stats.recognizeSeconds = seconds(start);
+    start = Clock::now();
+  }
+  auto forest = buildForest(chart);
+  if (options.observer) stats.forestSeconds = seconds(start);
 
-  auto build = [&](auto &build, Node node) -> R {
-    auto modelOpt = generator.findModel(node.symbol);
-    if (!modelOpt) return Error<>("Cannot find model: " + node.symbol);
-    auto model = *modelOpt;
+  if (forest)
+    for (const auto &token : tokens) forest->text.push_back(token.text);
+  return forest;
+}
 
-    std::vector<AnnotatedPtr> args;
-    std::vector<Generator::Concept *> models;
+auto parseForest(const CompiledGrammar &grammar, const TokenStream &tokens,
+                 ParseOptions options) -> Expected<Forest> {
+  ParseStats stats;
+  auto forest = earleyForest(grammar, tokens, options, stats);
+  if (options.observer) options.observer->onParse(stats);
+  return forest;
+}
 
-    if (!model->useStringToConstruct)
-      for (auto child : node.children) {
-        if (auto ret = build(build, child)) {
-          auto [arg, model] = *ret;
-          args.push_back(arg);
-          models.push_back(model);
-        } else {
-          return ret;
-        }
-      }
+auto parseForest(const CompiledGrammar &grammar, const Tokens &tokens,
+                 ParseOptions options) -> Expected<Forest> {
+  auto forest = parseForest(grammar, intern(grammar, tokens), options);
+  if (forest) forest->text.clear();
+  return forest;
+}
 
-    ScopeGuard guard{[&]() {
-      for (size_t i = 0; i < std::size(args); ++i)
-        models[i]->destruct(args[i].ptr);
-    }};
+// the trees of `forest`, with their number and the time they took in `stats`
+// if there is an observer
+auto trees(const Forest &forest, ParseObserver *observer, ParseStats &stats)
+    -> std::vector<Node> {
+  if (!observer) return trees(forest);
+  auto start = Clock::now();
+  auto nodes = trees(forest);
+  stats.trees = size(nodes);
+  stats.treeSeconds = seconds(start);
+  return nodes;
+}
 
-    if (model->useStringToConstruct && size(node.children) != 1)
-      return Error<>(
-          "Model binded with _UseString_ tag requires one child in "
-          "corresponding node");
+auto parseEarley(const CompiledGrammar &g, const TokenStream &tokens,
+                 const ParseOptions &options) -> Expected<std::vector<Node>> {
+  ParseStats stats;
+  auto forest = earleyForest(g, tokens, options, stats);
+  std::vector<Node> nodes;
+  if (forest) nodes = trees(*forest, options.observer, stats);
+  if (options.observer) options.observer->onParse(stats);
+  if (!forest) return Error<>(forest.error());
+  return nodes;
+}
 
-    if (auto ptr = !model->useStringToConstruct
-                       ? model->construct(args)
-                       : model->construct(node.children[0].symbol))
-      return std::pair{*ptr, model};
-    else
-      return Error<>("Cannot construct type: " + node.symbol);
-  };
+// `parse`, the GLR or LL1 parse of `tokens`, with its time and trees passed
+// to the observer if there is one
+template <typename F>
+auto observed(const TokenStream &tokens, const ParseOptions &options,
+              F parse) -> Expected<std::vector<Node>> {
+  if (!options.observer) return parse();
+  auto start = Clock::now();
+  auto nodes = parse();
+  ParseStats stats;
+  stats.tokens = size(tokens);
+  stats.trees = nodes ? size(*nodes) : 0;
+  stats.recognizeSeconds = seconds(start);
+  options.observer->onParse(stats);
+  return nodes;
+}
 
-  return build(build, node);
-}
-
-auto split(std::string_view text) {
-  std::vector<std::string> parts;
-  bool first = true;
-
-  for (size_t i = 0; i < size(text); ++i) {
-    bool nt = true;
-
-    if (text[i] == '(')
-      parts.push_back("(");
-    else if (text[i] == ')')
-      parts.push_back(")");
-    else if (text[i] == '?')
-      parts.push_back("?");
-    else if (text[i] == '*')
-      parts.push_back("*");
-    else if (text[i] == '+')
-      parts.push_back("+");
-    else if (text[i] == '&')
-      parts.push_back("&");
-    else if (text[i] == ':')
-      parts.push_back(":");
-    else if (text[i] == '|')
-      parts.push_back("|");
-    else if (text[i] == '\\')
-      parts.push_back("\\");
-    else if (text[i] == '-' && i + 1 < size(text) && text[i + 1] == '>')
-      (parts.push_back("->"), ++i);
-    else if (text[i] == '[')
-      parts.push_back("[");
-    else if (text[i] == ']') parts.push_back("]");
-    else if (text[i] == '{') parts.push_back("{");
-    else if (text[i] == '}') parts.push_back("}");
-    else if (text[i] == ',')
-      parts.push_back(",");
-    else if (text[i] == ' ')
-      ;
-    else {
-      nt = false;
-      if (first) parts.push_back("");
-      parts.back().push_back(text[i]);
-      first = false;
-    }
-    if (nt) first = true;
+namespace detail {
+
+struct EarleyState {
+  // counts the bytes of the chart if there is an observer
+  std::unique_ptr<CountingResource> counter;
+  Chart chart;
+  std::vector<std::string_view> text = {};
+};
+
+}  // namespace detail
+
+EarleyParser::EarleyParser(const CompiledGrammar &grammar,
+                           ParseOptions options) {
+  // the next token is not known when a set is processed
+  options.lookahead = false;
+  std::unique_ptr<CountingResource> counter;
+  auto *memory =
+      options.memory ? options.memory : std::pmr::get_default_resource();
+  if (options.observer)
+    memory = (counter = std::make_unique<CountingResource>(memory)).get();
+  // sets are dropped and rebuilt by edits, so their memory is reused
+  state.reset(new detail::EarleyState{
+      std::move(counter),
+      makeChart(grammar, options,
+                std::make_unique<std::pmr::unsynchronized_pool_resource>(
+                    memory))});
+  auto &chart = state->chart;
+  auto start = Clock::now();
+  resize(chart, 1);
+  if (grammar.start != -1) predict(chart, 0, grammar.start);
+  process(chart, 0);
+  if (chart.observer) chart.stats.recognizeSeconds += seconds(start);
+}
+
+EarleyParser::EarleyParser(EarleyParser &&) noexcept = default;
+auto EarleyParser::operator=(EarleyParser &&) noexcept
+    -> EarleyParser & = default;
+EarleyParser::~EarleyParser() = default;
+
+auto EarleyParser::feed(const Token &token) -> bool {
+  auto &chart = state->chart;
+  ScopeGuard timer{[&, start = chart.observer ? Clock::now()
+                                              : Clock::time_point()] {
+    if (chart.observer) chart.stats.recognizeSeconds += seconds(start);
+  }};
+  auto k = size(chart.tokens);
+  chart.tokens.push_back(token.symbol);
+  chart.sets.emplace_back(chart.memory.get());
+  scan(chart, k);
+
+  if (chart.sets.back().items.empty()) {
+    chart.sets.pop_back();
+    chart.tokens.pop_back();
+    return false;
   }
 
-  // for(auto p: parts) std::cout << p << " ";
-  // std::cout << "\n";
+  state->text.push_back(token.text);
+  process(chart, k + 1);
+  return true;
+}
 
-  return parts;
+auto EarleyParser::feed(std::string_view symbol) -> bool {
+  return feed(Token{state->chart.grammar.id(symbol)});
 }
 
-auto parseSpec(std::string text) -> Specification {
-  Specification spec;
+// whether set `k` holds the items set `x` held before an edit of the tokens
+// after set `begin`, and none of its incomplete items starts within the edit.
+// Complete items are not carried on to later sets, so they may start anywhere
+auto converged(const CompiledGrammar &g, const StateSet &set, size_t k,
+               const StateSet &old, size_t x, size_t begin) -> bool {
+  if (size(set.items) != size(old.items)) return false;
+  for (size_t i = 0; i != size(set.items); ++i) {
+    const auto &a = set.items[i], &b = old.items[i];
+    if (a.rule != b.rule || a.dot != b.dot || a.attributes != b.attributes ||
+        a.looped != b.looped || a.predicted != b.predicted)
+      return false;
+    if (a.origin <= begin || b.origin <= begin) {
+      if (a.origin != b.origin) return false;
+    } else if (!isComplete(g, a) && (a.origin != k || b.origin != x)) {
+      return false;
+    }
+  }
+  return true;
+}
 
-  // std::set<std::string> templateRules;
+// moves the set indices after `begin` that `set` refers to by `delta`
+void shift(StateSet &set, size_t begin, int64_t delta) {
+  auto remap = [&](uint32_t &k) {
+    if (k > begin) k = uint32_t(k + delta);
+  };
+  for (auto &item : set.items) remap(item.origin);
+  for (auto &link : set.links) remap(link.predSet);
+  for (auto &[symbol, entry] : set.leo) remap(entry.top.origin);
+}
 
-  forEachLine(text, [&](auto line) {
-    if (line[0] == '#') return;
-    auto parts = split(line);
-    if (size(parts) < 7) return;
+auto EarleyParser::edit(const TokenStream &tokens, size_t begin, size_t end)
+    -> bool {
+  auto &chart = state->chart;
+  ScopeGuard timer{[&, start = chart.observer ? Clock::now()
+                                              : Clock::time_point()] {
+    if (chart.observer) chart.stats.recognizeSeconds += seconds(start);
+  }};
+  auto n = size(chart.tokens);
+  auto delta = int64_t(size(tokens)) - int64_t(n);
+  if (begin > end || end > n || int64_t(end) + delta < int64_t(begin))
+    return false;
+
+  // The sets up to `begin` do not depend on the tokens from `begin` on. The
+  // new sets after it replace the old ones in place, which are set aside in
+  // order, so that the sets after the edit only move if its length changes
+  std::vector<int> oldTokens(chart.tokens.begin() + begin, chart.tokens.end());
+  std::deque<StateSet> old;
+  auto oldSet = [&](size_t x) -> StateSet & {
+    return x <= begin + size(old) ? old[x - begin - 1] : chart.sets[x];
+  };
 
-    auto p0 = find(begin(parts), end(parts), "[");
-    auto p1 = find(begin(parts), end(parts), "]");
+  chart.tokens.resize(begin);
+  for (auto &k : chart.predicted)
+    if (k > begin + 1) k = 0;
+
+  auto restore = [&] {
+    for (size_t x = begin + 1; x != begin + 1 + size(old); ++x)
+      chart.sets[x] = std::move(old[x - begin - 1]);
+    resize(chart, n + 1);
+    chart.tokens.resize(begin);
+    chart.tokens.insert(chart.tokens.end(), oldTokens.begin(),
+                        oldTokens.end());
+    for (auto &k : chart.predicted)
+      if (k > begin + 1) k = 0;
+    return false;
+  };
 
-    if (p0 != end(parts)) {
-      auto name = *(p0 - 1);
-      // templateRules.insert(name);
+  // scans token `j` of `tokens` into the next set and processes it
+  auto step = [&](size_t j) {
+    auto k = size(chart.tokens);
+    chart.tokens.push_back(tokens[j].symbol);
+    if (k + 1 <= n) {
+      old.push_back(std::move(chart.sets[k + 1]));
+      chart.sets[k + 1] = StateSet(chart.memory.get());
+    } else {
+      chart.sets.emplace_back(chart.memory.get());
+    }
 
-      std::map<std::string, std::string> map;
-      std::pair<decltype(map)::iterator, bool> it;
-      bool lhs = true;
-      for (auto p = p0 + 1; p != p1; ++p) {
-        if (lhs) {
-          it = map.insert(std::pair{*p, ""});
-          lhs = false;
-        } else if (*p == "," && *(p - 1) != "\\")
-          lhs = true;
-        else if (*p != "->" && *p != "\\")
-          it.first->second += *p + " ";
-      }
+    scan(chart, k);
+    if (chart.sets[k + 1].items.empty()) return false;
+    process(chart, k + 1);
+    return true;
+  };
 
-      forEachLine(text, [&](auto line2) {
-        if (line2.substr(0, line2.find(' ')) == name) {
-          for (auto pair : map)
-            line2 = std::regex_replace(
-                line2, std::regex(pair.first),
-                pair.second.substr(0, size(pair.second) - 1));
-          line2.erase(0, std::min(line2.find("=="), line2.find(">=")) + 2);
-
-          text += "\n";
-          for (auto p = begin(parts); p != p0 - 1; ++p) text += *p + " ";
-          text += line2;
-          for (auto p = p1 + 1; p != end(parts); ++p) text += " " + *p;
-        }
-      });
+  for (auto j = begin; j != size_t(end + delta); ++j)
+    if (!step(j)) return restore();
+
+  // once a set after the edit holds the same items as before, so do the sets
+  // that follow it
+  auto x = end;
+  for (; x != n; ++x) {
+    if (!step(x + delta)) return restore();
+    auto k = size(chart.sets) - 1;
+    if (converged(chart.grammar, chart.sets[k], k, oldSet(x + 1), x + 1,
+                  begin))
+      break;
+  }
+
+  if (x != n) {
+    auto k = size_t(x + 1 + delta);
+    // the Leo entries of the set were computed by the sets that follow it
+    shift(oldSet(x + 1), begin, delta);
+    chart.sets[k].leo = std::move(oldSet(x + 1).leo);
+
+    auto move = [&](size_t y) {
+      auto &set = oldSet(y);
+      shift(set, begin, delta);
+      chart.sets[y + delta] = std::move(set);
+    };
+    if (delta > 0) {
+      resize(chart, n + delta + 1);
+      for (auto y = n; y != x + 1; --y) move(y);
+    } else if (delta < 0) {
+      for (auto y = x + 2; y <= n; ++y) move(y);
+      resize(chart, n + delta + 1);
     }
+
+    for (auto j = size_t(x + 1 + delta); j != size(tokens); ++j)
+      chart.tokens.push_back(tokens[j].symbol);
+  }
+  resize(chart, size(tokens) + 1);
+
+  state->text.clear();
+  for (const auto &token : tokens) state->text.push_back(token.text);
+  return true;
+}
+
+auto EarleyParser::canAccept() const -> bool {
+  const auto &g = state->chart.grammar;
+  const auto &items = state->chart.sets.back().items;
+  return std::any_of(begin(items), end(items), [&](const Item &item) {
+    return item.origin == 0 && g.rules[item.rule].symbol == g.start &&
+           isComplete(g, item);
   });
+}
 
-  // std::cout << text << "\n";
+auto EarleyParser::expectedNext() const -> std::vector<std::string> {
+  const auto &g = state->chart.grammar;
+  std::vector<std::string> symbols;
+  // the waiting items are sorted by the symbol they wait for
+  for (auto [symbol, i] : state->chart.sets.back().waiting)
+    if (!g.isNonTerminal(symbol) &&
+        (symbols.empty() || symbols.back() != g.symbols[symbol]))
+      symbols.push_back(g.symbols[symbol]);
+  return symbols;
+}
 
-  forEachLine(text, [&](auto line) {
-    if (line[0] == '#') return;
-    auto parts = split(line);
+auto EarleyParser::finish() const -> Expected<std::vector<Node>> {
+  const auto &chart = state->chart;
+  if (chart.grammar.start == -1) return Error<>("empty specification");
+  if (!chart.observer) {
+    auto forest = buildForest(chart);
+    if (!forest) return Error<>(forest.error());
+    forest->text = state->text;
+    return trees(*forest);
+  }
 
-    auto p0 = find(begin(parts), end(parts), "{");
-    auto p1 = find(begin(parts), end(parts), "}");
+  // the statistics of the sets add up over all feeds and edits so far
+  auto stats = chart.stats;
+  stats.tokens = size(chart.tokens);
+  stats.chartBytes = state->counter->bytes;
+  auto start = Clock::now();
+  auto forest = buildForest(chart);
+  stats.forestSeconds = seconds(start);
+  std::vector<Node> nodes;
+  if (forest) {
+    forest->text = state->text;
+    nodes = trees(*forest, chart.observer, stats);
+  }
+  chart.observer->onParse(stats);
+  if (!forest) return Error<>(forest.error());
+  return nodes;
+}
 
-    if (size(parts) < 3) {
-      std::cout << "invalid line: " << line << '\n';
-      return;
-    }
+auto parse(const Specification &spec, const Tokens &tokens,
+           ParserType parserType, ParseOptions options)
+    -> Expected<std::vector<Node>> {
+  return parse(compile(spec), tokens, parserType, options);
+}
 
-    if (find(begin(parts), end(parts), "[") != end(parts)) return;
-    // if (templateRules.find(parts[0]) != end(templateRules)) return;
+auto parse(const CompiledGrammar &grammar, const Tokens &tokens,
+           ParserType parserType, ParseOptions options)
+    -> Expected<std::vector<Node>> {
+  // the text of the tokens refers to `tokens` only where parsing fails
+  return parse(grammar, intern(grammar, tokens), parserType, options);
+}
 
-    spec.addSymbol(parts[0]);
+auto parse(const CompiledGrammar &grammar, const TokenStream &tokens,
+           ParserType parserType, ParseOptions options)
+    -> Expected<std::vector<Node>> {
+  switch (parserType) {
+    case ParserType::Earley:
+      return parseEarley(grammar, tokens, options);
+    case ParserType::GLR:
+      return observed(tokens, options,
+                      [&] { return parseGLR(grammar, tokens); });
+    case ParserType::LL1:
+      return observed(tokens, options,
+                      [&] { return parseLL1(grammar, tokens); });
+    case ParserType::Auto:
+      if (isLL1(grammar))
+        return observed(tokens, options,
+                        [&] { return parseLL1(grammar, tokens); });
+      return parseEarley(grammar, tokens, options);
+    default:
+      return Error<>("Invalid parser type");
+  }
+}
 
-    if (p0 != p1)
-      for (auto p = p0 + 1; p != p1; ++p) spec.addAttributes(*p);
+namespace {
 
-    auto it = std::min(find(begin(parts), end(parts), ">="),
-                       find(begin(parts), end(parts), "=="));
-    if (it == end(parts)) {
-      std::cout << "Invalid line: " << line << "\n";
-      return;
+// The nodes of a Node tree as ObjectBuilder visits them
+struct NodeTree {
+  auto symbol(const Node &node) const -> const std::string & {
+    return node.symbol;
+  }
+  auto children(const Node &node) const -> const std::vector<Node> * {
+    return &node.children;
+  }
+};
+
+// The nodes of the only tree of a forest, visited without building it
+struct ForestTree {
+  struct Children {
+    auto begin() const { return first; }
+    auto end() const { return last; }
+    auto size() const { return size_t(last - first); }
+    auto operator[](size_t i) const { return first[i]; }
+
+    const uint32_t *first, *last;
+  };
+
+  auto symbol(uint32_t n) const -> const std::string & {
+    return forest.grammar->symbols[forest.nodes[n].symbol];
+  }
+  // none if the node has more than one tree
+  auto children(uint32_t n) const -> std::optional<Children> {
+    const auto &node = forest.nodes[n];
+    if (node.leaf) return Children{nullptr, nullptr};
+    if (node.familiesEnd - node.familiesBegin != 1) return std::nullopt;
+    const auto &family = forest.families[node.familiesBegin];
+    return Children{forest.children.data() + family.childrenBegin,
+                    forest.children.data() + family.childrenEnd};
+  }
+
+  const Forest &forest;
+};
+
+// Builds the objects of a tree bottom up. The objects of the children built
+// so far are kept on top of `args`, which is shared by all nodes
+template <typename Tree, typename FindModel>
+struct ObjectBuilder {
+  using Result = Expected<std::pair<AnnotatedPtr, const Generator::Concept *>>;
+
+  template <typename N>
+  auto build(const N &node) -> Result {
+    const Generator::Concept *model = findModel(node);
+    if (!model) return Error<>("Cannot find model: " + tree.symbol(node));
+    auto children = tree.children(node);
+    if (!children) return Error<>("Ambiguous node: " + tree.symbol(node));
+
+    if (model->useStringToConstruct) {
+      if (children->size() != 1)
+        return Error<>(
+            "Model binded with _UseString_ tag requires one child in "
+            "corresponding node");
+      if (auto ptr = model->construct(tree.symbol((*children)[0]), memory))
+        return std::pair{*ptr, model};
+      return Error<>("Cannot construct type: " + tree.symbol(node));
     }
-    auto start = it - begin(parts);
-
-    if (parts[start] == "==") spec.setIntermediate();
-
-    bool isAttrib = false;
-
-    for (size_t i = start + 1; i < size(parts); ++i) {
-      if (parts[i] == "\\")
-        spec >= parts[++i];
-      else if (parts[i] == "|")
-        spec.addAlternative();
-      else if (parts[i] == "(")
-        spec.addLeftParenthesis();
-      else if (parts[i] == ")")
-        spec.addRightParenthesis();
-      else if(parts[i] == "{") isAttrib = true;
-      else if(parts[i] == "}") isAttrib = false;
-      else if (parts[i] == "?")
-        spec.activeRule().expr.back().optional = true;
-      else if (parts[i] == "*")
-        spec.activeRule().expr.back().arbitrary = true;
-      else if (parts[i] == "+")
-        spec.activeRule().expr.back().oneOrMore = true;
-      else if (parts[i] == "&")
-        spec.activeRule().expr.back().deref = true;
-      else if(isAttrib) 
-        spec.activeRule().expr.back().attribs.push_back(parts[i]);
-      else
-        spec.addExpr(parts[i]);
+
+    auto base = size(args);
+    ScopeGuard guard{[&]() {
+      for (auto i = base; i != size(args); ++i)
+        models[i]->destruct(args[i].ptr);
+      args.resize(base);
+      models.resize(base);
+    }};
+
+    for (const auto &child : *children) {
+      auto ret = build(child);
+      if (!ret) return ret;
+      args.push_back(ret->first);
+      models.push_back(ret->second);
     }
-  });
 
-  return spec;
+    if (auto ptr = model->construct(args.data() + base, size(args) - base,
+                                    memory))
+      return std::pair{*ptr, model};
+    return Error<>("Cannot construct type: " + tree.symbol(node));
+  }
+
+  Tree tree;
+  FindModel findModel;
+  std::pmr::memory_resource &memory;
+  std::vector<AnnotatedPtr> args = {};
+  std::vector<const Generator::Concept *> models = {};
+};
+
+template <typename Tree, typename FindModel>
+ObjectBuilder(Tree, FindModel, std::pmr::memory_resource &)
+    -> ObjectBuilder<Tree, FindModel>;
+
+}  // namespace
+
+auto compile(const Generator &generator, const CompiledGrammar &grammar)
+    -> CompiledGenerator {
+  CompiledGenerator compiled;
+  for (const auto &symbol : grammar.symbols) {
+    auto it = generator.models.find(symbol);
+    compiled.models.push_back(it != end(generator.models) ? it->second
+                                                          : nullptr);
+  }
+  return compiled;
+}
+
+auto generateImpl(const Generator &generator, const Node &node,
+                  std::pmr::memory_resource &memory)
+    -> Expected<std::pair<AnnotatedPtr, const Generator::Concept *>> {
+  auto findModel = [&](const Node &node) -> const Generator::Concept * {
+    return generator.findModel(node.symbol).value_or(nullptr);
+  };
+  return ObjectBuilder{NodeTree{}, findModel, memory}.build(node);
+}
+
+auto generateImpl(const CompiledGenerator &generator, const Node &node,
+                  std::pmr::memory_resource &memory)
+    -> Expected<std::pair<AnnotatedPtr, const Generator::Concept *>> {
+  auto findModel = [&](const Node &node) {
+    return generator.findModel(node.id);
+  };
+  return ObjectBuilder{NodeTree{}, findModel, memory}.build(node);
+}
+
+auto generateImpl(const Generator &generator, const Forest &forest,
+                  std::pmr::memory_resource &memory)
+    -> Expected<std::pair<AnnotatedPtr, const Generator::Concept *>> {
+  ForestTree tree{forest};
+  auto findModel = [&](uint32_t n) -> const Generator::Concept * {
+    return generator.findModel(tree.symbol(n)).value_or(nullptr);
+  };
+  return ObjectBuilder{tree, findModel, memory}.build(forest.root);
+}
+
+auto generateImpl(const CompiledGenerator &generator, const Forest &forest,
+                  std::pmr::memory_resource &memory)
+    -> Expected<std::pair<AnnotatedPtr, const Generator::Concept *>> {
+  auto findModel = [&](uint32_t n) {
+    return generator.findModel(forest.nodes[n].symbol);
+  };
+  return ObjectBuilder{ForestTree{forest}, findModel, memory}.build(
+      forest.root);
 }
 
 }  // namespace tiny_bnf
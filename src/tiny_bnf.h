@@ -1,13 +1,19 @@
 #ifndef TINY_BNF_H
 #define TINY_BNF_H
 
+#include <array>
+#include <cstdint>
+#include <functional>
 #include <iostream>
 #include <map>
 #include <memory>
+#include <memory_resource>
 #include <optional>
 #include <set>
 #include <sstream>
+#include <stdexcept>
 #include <string>
+#include <string_view>
 #include <variant>
 #include <vector>
 
@@ -56,15 +62,15 @@ struct Leftparenthesis {};
 struct RightParenthesis {};
 
 struct Optional {
-  std::string symbol;
+  std::string_view symbol;
 };
 
 struct Arbitrary {
-  std::string symbol;
+  std::string_view symbol;
 };
 
 struct OneOrMore {
-  std::string symbol;
+  std::string_view symbol;
 };
 
 template <typename T>
@@ -119,9 +125,15 @@ inline void mergeAttributes(Rule &dst, const Rule &ref) {
   for (auto &a : ref.attributes) dst.attributes.insert(ref.symbol + "." + a);
 }
 
-inline auto opt(std::string symbol) { return detail::Optional{symbol}; }
-inline auto arb(std::string symbol) { return detail::Arbitrary{symbol}; }
-inline auto oom(std::string symbol) { return detail::OneOrMore{symbol}; }
+constexpr auto opt(std::string_view symbol) {
+  return detail::Optional{symbol};
+}
+constexpr auto arb(std::string_view symbol) {
+  return detail::Arbitrary{symbol};
+}
+constexpr auto oom(std::string_view symbol) {
+  return detail::OneOrMore{symbol};
+}
 template <typename T>
 inline auto deref(T x) {
   return detail::Deref{x};
@@ -237,11 +249,357 @@ struct Terminals {
 
 Terminals autoTerminals(const Specification &spec);
 
+namespace detail {
+struct Tables;
+struct EarleyState;
+struct RuleProfile;
+
+auto makeTables() -> std::shared_ptr<Tables>;
+}  // namespace detail
+
+// Specification with every symbol and attribute interned into a dense integer
+// id and every rule stored in flat arrays. Build it once with compile() and
+// reuse it across parse() calls
+struct CompiledGrammar {
+  struct Expr {
+    int symbol = 0;
+    uint32_t attribsBegin = 0;
+    uint32_t attribsEnd = 0;
+    bool optional = false;
+    bool arbitrary = false;
+    bool oneOrMore = false;
+    bool deref = false;
+  };
+
+  struct Rule {
+    int symbol = 0;
+    uint32_t exprBegin = 0;
+    uint32_t exprEnd = 0;
+    uint32_t attribsBegin = 0;
+    uint32_t attribsEnd = 0;
+    size_t idx = 0;
+    bool intermediate = false;
+    bool alias = false;
+    // the rule can derive the empty sequence
+    bool nullable = false;
+  };
+
+  auto id(std::string_view symbol) const -> int {
+    auto it = ids.find(symbol);
+    return it != std::end(ids) ? it->second : -1;
+  }
+  auto isNonTerminal(int symbol) const -> bool {
+    return alternativesBegin[symbol] != alternativesBegin[symbol + 1];
+  }
+  auto size(const Rule &rule) const -> size_t {
+    return rule.exprEnd - rule.exprBegin;
+  }
+  // whether `terminal` is in the FIRST set of `rule`
+  auto startsWith(uint32_t rule, int terminal) const -> bool {
+    return first[rule * firstWords + terminal / 64] >> (terminal % 64) & 1;
+  }
+
+  std::vector<std::string> symbols;
+  std::map<std::string, int, std::less<>> ids;
+  std::vector<Rule> rules;
+  std::vector<Expr> exprs;
+
+  // rule ids grouped by their left hand side symbol
+  std::vector<uint32_t> alternatives;
+  std::vector<uint32_t> alternativesBegin;
+
+  // attribute ids, referenced by Expr (required) and Rule (provided). Only
+  // attributes that can end up satisfying a requirement are interned
+  std::vector<int> attribs;
+  std::vector<std::string> attributes;
+
+  // (attribute, symbol + "." + attribute) pairs per symbol, used to merge the
+  // attributes of a completed child into its parent
+  std::vector<std::pair<int, int>> merges;
+  std::vector<uint32_t> mergesBegin;
+
+  // FIRST set of each rule, as a bitset over symbol ids of `firstWords` words.
+  // Attribute requirements are ignored, so these are supersets
+  std::vector<uint64_t> first;
+  size_t firstWords = 0;
+  std::vector<bool> nullable;
+
+  int start = -1;
+
+  // tables of the table driven parsers, built on first use
+  std::shared_ptr<detail::Tables> tables;
+};
+
+CompiledGrammar compile(const Specification &spec);
+
+// the terminals of `grammar`, each matching its own text
+Terminals autoTerminals(const CompiledGrammar &grammar);
+
+namespace detail {
+
+struct StaticRule {
+  std::string_view symbol;
+  size_t exprBegin = 0;
+  size_t exprEnd = 0;
+  size_t idx = 0;
+  bool intermediate = false;
+};
+
+struct StaticExpr {
+  std::string_view symbol;
+  bool optional = false;
+  bool arbitrary = false;
+  bool oneOrMore = false;
+};
+
+// fails the constant evaluation of a static grammar, and so its compilation
+// with `what` in the error
+constexpr void staticCheck(bool ok, const char *what) {
+  if (!ok) throw std::length_error(what);
+}
+
+}  // namespace detail
+
+// Specification that can be written in constant expressions, with room for
+// at most `Symbols` symbols, `Rules` rules and `Exprs` exprs. It takes the
+// same operators, except for attributes, deref and parentheses:
+//
+//   constexpr auto numberSpecification() {
+//     tiny_bnf::StaticSpecification<16, 16, 16> spec;
+//     spec["number"] >= opt("number"), "digit";
+//     spec["digit"] >= "0" | "1" | "2";
+//     return spec;
+//   }
+//   constexpr auto number = tiny_bnf::compile(numberSpecification());
+//
+// Symbols are views, so they must outlive the specification, as literals do
+template <size_t Symbols, size_t Rules, size_t Exprs>
+struct StaticSpecification {
+  constexpr auto operator[](std::string_view symbol)
+      -> StaticSpecification & {
+    detail::staticCheck(nRules != Rules, "too many rules");
+    rules[nRules] = {symbol, nExprs, nExprs, nRules};
+    ++nRules;
+    return *this;
+  }
+
+  template <typename T>
+  constexpr auto operator>=(T expr) -> StaticSpecification & {
+    return addExpr(expr);
+  }
+  template <typename T>
+  constexpr auto operator,(T expr) -> StaticSpecification & {
+    return addExpr(expr);
+  }
+  template <typename T>
+  constexpr auto operator|(T expr) -> StaticSpecification & {
+    addAlternative();
+    return addExpr(expr);
+  }
+  template <typename T>
+  constexpr auto operator==(T expr) -> StaticSpecification & {
+    rules[nRules - 1].intermediate = true;
+    return addExpr(expr);
+  }
+
+  constexpr auto operator,(detail::Or) -> StaticSpecification & {
+    return addAlternative();
+  }
+
+  constexpr auto addExpr(std::string_view symbol) -> StaticSpecification & {
+    return addExpr(detail::StaticExpr{symbol});
+  }
+  constexpr auto addExpr(detail::Optional e) -> StaticSpecification & {
+    return addExpr(detail::StaticExpr{e.symbol, true});
+  }
+  constexpr auto addExpr(detail::Arbitrary e) -> StaticSpecification & {
+    return addExpr(detail::StaticExpr{e.symbol, false, true});
+  }
+  constexpr auto addExpr(detail::OneOrMore e) -> StaticSpecification & {
+    return addExpr(detail::StaticExpr{e.symbol, false, false, true});
+  }
+  constexpr auto addExpr(detail::StaticExpr e) -> StaticSpecification & {
+    detail::staticCheck(nRules != 0, "expr before the first rule");
+    detail::staticCheck(nExprs != Exprs, "too many exprs");
+    exprs[nExprs++] = e;
+    rules[nRules - 1].exprEnd = nExprs;
+    return *this;
+  }
+
+  // a new rule of the active symbol, which takes the following exprs
+  constexpr auto addAlternative() -> StaticSpecification & {
+    detail::staticCheck(nRules != 0, "alternative before the first rule");
+    detail::staticCheck(nRules != Rules, "too many rules");
+    auto rule = rules[nRules - 1];
+    rule.exprBegin = rule.exprEnd = nExprs;
+    rule.idx += 1;
+    rules[nRules++] = rule;
+    return *this;
+  }
+
+  std::array<detail::StaticRule, Rules> rules = {};
+  size_t nRules = 0;
+  std::array<detail::StaticExpr, Exprs> exprs = {};
+  size_t nExprs = 0;
+};
+
+// CompiledGrammar computed by the compiler: symbol ids, rules, alternatives,
+// nullable symbols and FIRST sets are the same as compile() computes for the
+// equivalent Specification. Its ids are constants, so that code can dispatch
+// on them, as in `case number.id("digit"):`
+template <size_t Symbols, size_t Rules, size_t Exprs>
+struct StaticGrammar {
+  static constexpr size_t kWords = (Symbols + 63) / 64;
+
+  constexpr auto id(std::string_view symbol) const -> int {
+    for (size_t s = 0; s != nSymbols; ++s)
+      if (symbols[s] == symbol) return int(s);
+    return -1;
+  }
+  constexpr auto isNonTerminal(int symbol) const -> bool {
+    return alternativesBegin[symbol] != alternativesBegin[symbol + 1];
+  }
+
+  // The grammar for the parsers. Its arrays are copied, nothing is computed
+  auto compiled() const -> CompiledGrammar {
+    CompiledGrammar g;
+    for (size_t s = 0; s != nSymbols; ++s) {
+      g.symbols.emplace_back(symbols[s]);
+      g.ids.emplace(symbols[s], int(s));
+    }
+    g.rules.assign(begin(rules), begin(rules) + nRules);
+    g.exprs.assign(begin(exprs), begin(exprs) + nExprs);
+    g.alternatives.assign(begin(alternatives), begin(alternatives) + nRules);
+    g.alternativesBegin.assign(begin(alternativesBegin),
+                               begin(alternativesBegin) + nSymbols + 1);
+    g.mergesBegin.assign(nSymbols + 1, 0);
+    g.firstWords = (nSymbols + 63) / 64;
+    g.first.assign(begin(first), begin(first) + nRules * g.firstWords);
+    g.nullable.assign(begin(nullable), begin(nullable) + nSymbols);
+    g.start = start;
+    g.tables = detail::makeTables();
+    return g;
+  }
+
+  std::array<std::string_view, Symbols> symbols = {};
+  size_t nSymbols = 0;
+  std::array<CompiledGrammar::Rule, Rules> rules = {};
+  size_t nRules = 0;
+  std::array<CompiledGrammar::Expr, Exprs> exprs = {};
+  size_t nExprs = 0;
+  std::array<uint32_t, Rules> alternatives = {};
+  std::array<uint32_t, Symbols + 1> alternativesBegin = {};
+  std::array<uint64_t, Rules * kWords> first = {};
+  std::array<bool, Symbols> nullable = {};
+  int start = -1;
+};
+
+template <size_t Symbols, size_t Rules, size_t Exprs>
+constexpr auto compile(const StaticSpecification<Symbols, Rules, Exprs> &spec)
+    -> StaticGrammar<Symbols, Rules, Exprs> {
+  StaticGrammar<Symbols, Rules, Exprs> g;
+
+  // symbols of the left hand sides first, in the order of compile()
+  auto intern = [&g](std::string_view symbol) {
+    if (auto id = g.id(symbol); id != -1) return id;
+    detail::staticCheck(g.nSymbols != Symbols, "too many symbols");
+    g.symbols[g.nSymbols] = symbol;
+    return int(g.nSymbols++);
+  };
+  for (size_t r = 0; r != spec.nRules; ++r) intern(spec.rules[r].symbol);
+  for (size_t e = 0; e != spec.nExprs; ++e) intern(spec.exprs[e].symbol);
+
+  for (size_t r = 0; r != spec.nRules; ++r) {
+    const auto &rule = spec.rules[r];
+    auto &compiled = g.rules[r];
+    compiled.symbol = g.id(rule.symbol);
+    compiled.exprBegin = rule.exprBegin;
+    compiled.exprEnd = rule.exprEnd;
+    compiled.idx = rule.idx;
+    compiled.intermediate = rule.intermediate;
+  }
+  g.nRules = spec.nRules;
+  for (size_t e = 0; e != spec.nExprs; ++e) {
+    const auto &expr = spec.exprs[e];
+    auto &compiled = g.exprs[e];
+    compiled.symbol = g.id(expr.symbol);
+    compiled.optional = expr.optional;
+    compiled.arbitrary = expr.arbitrary;
+    compiled.oneOrMore = expr.oneOrMore;
+  }
+  g.nExprs = spec.nExprs;
+
+  for (size_t s = 0, n = 0; s != g.nSymbols; ++s) {
+    g.alternativesBegin[s] = n;
+    for (size_t r = 0; r != g.nRules; ++r)
+      if (g.rules[r].symbol == int(s)) g.alternatives[n++] = r;
+    g.alternativesBegin[s + 1] = n;
+  }
+  if (g.nRules) g.start = g.rules[0].symbol;
+
+  // as computeFirstSets does
+  auto skippable = [&g](const CompiledGrammar::Expr &expr) {
+    return expr.optional || expr.arbitrary || g.nullable[expr.symbol];
+  };
+  for (bool changed = true; changed;) {
+    changed = false;
+    for (size_t r = 0; r != g.nRules; ++r) {
+      auto &rule = g.rules[r];
+      auto nullable = !rule.nullable;
+      for (auto e = rule.exprBegin; nullable && e != rule.exprEnd; ++e)
+        nullable = skippable(g.exprs[e]);
+      if (nullable) rule.nullable = g.nullable[rule.symbol] = changed = true;
+    }
+  }
+
+  auto words = (g.nSymbols + 63) / 64;
+  std::array<uint64_t, Symbols * StaticGrammar<Symbols, Rules, Exprs>::kWords>
+      first = {};
+  for (size_t s = 0; s != g.nSymbols; ++s)
+    if (!g.isNonTerminal(s)) first[s * words + s / 64] |= uint64_t(1) << s % 64;
+
+  auto unite = [&](uint64_t *dst, const CompiledGrammar::Rule &rule) {
+    bool changed = false;
+    for (auto e = rule.exprBegin; e != rule.exprEnd; ++e) {
+      const auto *src = &first[g.exprs[e].symbol * words];
+      for (size_t w = 0; w != words; ++w)
+        if ((dst[w] | src[w]) != dst[w]) (dst[w] |= src[w], changed = true);
+      if (!skippable(g.exprs[e])) break;
+    }
+    return changed;
+  };
+  for (bool changed = true; changed;) {
+    changed = false;
+    for (size_t r = 0; r != g.nRules; ++r)
+      changed =
+          unite(&first[g.rules[r].symbol * words], g.rules[r]) || changed;
+  }
+  for (size_t r = 0; r != g.nRules; ++r) unite(&g.first[r * words], g.rules[r]);
+
+  return g;
+}
+
 using Tokens = std::vector<std::string>;
 
+// Token that refers to the input it was matched from instead of holding a
+// copy of its symbol. `symbol` is the id of the symbol in the grammar, or -1
+// if the grammar has no such symbol
+struct Token {
+  int symbol = -1;
+  std::string_view text = {};
+};
+
+using TokenStream = std::vector<Token>;
+
 struct Node {
   std::string symbol;
   std::vector<Node> children;
+  // the input the node spans, for trees parsed from a TokenStream. Empty for
+  // nodes that derive no tokens
+  std::string_view text = {};
+  // id of `symbol` in the grammar the tree was parsed with, -1 for nodes
+  // built by hand
+  int id = -1;
 };
 
 template <typename F>
@@ -254,13 +612,284 @@ inline bool operator==(const Node &a, const Node &b) {
   return a.symbol == b.symbol && a.children == b.children;
 }
 
+// Terminals compiled into a trie shaped DFA, whose transitions are indexed by
+// byte classes instead of bytes. Build it once with compile() and reuse it
+// across tokenize() calls
+struct CompiledTerminals {
+  auto next(uint32_t state, char c) const -> uint32_t {
+    return transitions[state * nClasses + classes[uint8_t(c)]];
+  }
+
+  // bytes that appear in no terminal share class 0
+  std::array<uint8_t, 256> classes = {};
+  size_t nClasses = 1;
+  // by state and class, 0 is the start state and kDead has no way out
+  std::vector<uint32_t> transitions;
+  // index into `symbols` of the terminal ending in each state, or -1
+  std::vector<int> accepts;
+  std::vector<std::string> symbols;
+  // bytes that are terminals of an empty symbol on their own, skipped in runs
+  std::string skip;
+
+  static constexpr uint32_t kDead = 0xffffffff;
+};
+
+CompiledTerminals compile(const Terminals &terminals);
+
+// Splits `input` into the symbols of the longest matching terminal at each
+// position, dropping those whose symbol is empty. If `delimit` is set, a
+// terminal that starts with a word character only matches up to the end of
+// a word
+Expected<Tokens> tokenize(const CompiledTerminals &terminals,
+                          std::string_view input, bool delimit = false);
 Expected<Tokens> tokenize(const Terminals &terminals, std::string_view input,
                           bool delimit = false);
+// Same as above with the symbols looked up in `grammar`. The text of the tokens
+// refers to `input`, which must outlive them and the trees parsed from them
+Expected<TokenStream> tokenize(const CompiledTerminals &terminals,
+                               const CompiledGrammar &grammar,
+                               std::string_view input, bool delimit = false);
+
+// Writes `terminals` and `grammar` to a binary file, to be loaded by other
+// processes instead of building them again. The arrays they consist of are
+// stored as they are in memory, so loadCompiled() maps the file and copies
+// them out without parsing. Files written by another version of the library
+// or for another machine are rejected. The parse tables of the grammar are
+// not stored, they are still built on first use
+Expected<size_t> saveCompiled(const std::string &filename,
+                              const CompiledTerminals &terminals,
+                              const CompiledGrammar &grammar);
+Expected<std::pair<CompiledTerminals, CompiledGrammar>> loadCompiled(
+    const std::string &filename);
+
+// Earley works on the rules directly. GLR drives a graph structured stack with
+// LALR(1) tables of the grammar, built on the first GLR parse of a grammar.
+// LL1 is a predictive parser for grammars that are LL(1) once their left
+// recursion is removed and their rules are left factored. Auto picks LL1 for
+// such grammars, and Earley for the others
+enum ParserType { Earley, GLR, LL1, Auto };
+
+// Work done on the items of one rule in an Earley state set
+struct RuleStats {
+  size_t items = 0;
+  // derivations of items of the set by completing an item of the rule
+  size_t completions = 0;
+};
 
-enum ParserType { Earley };
+// Work done on one Earley state set, once it is done
+struct SetStats {
+  size_t set = 0;
+  // items of the set, and those of them that were predicted
+  size_t items = 0;
+  size_t predictions = 0;
+  // derivations of the items by scanning the token before the set, and by
+  // completing an item of an earlier set, with or without Leo links
+  size_t scans = 0;
+  size_t completions = 0;
+  // derivations of items that an earlier derivation had already added
+  size_t duplicates = 0;
+  // seconds spent on processing the items of the set
+  double seconds = 0;
+  // the work by rule, indexed like CompiledGrammar::rules, if the observer
+  // profiles rules, else null. Only valid during the call
+  const RuleStats *rules = nullptr;
+};
 
-Expected<std::vector<Node>> parse(const Specification &spec, Tokens tokens,
-                                  ParserType parserType = ParserType::Earley);
+// Work and time of a parse. The Earley counts are the totals of its sets,
+// which GLR and LL1 leave at 0
+struct ParseStats {
+  size_t tokens = 0;
+  size_t sets = 0;
+  size_t items = 0;
+  size_t predictions = 0;
+  size_t scans = 0;
+  size_t completions = 0;
+  size_t duplicates = 0;
+  size_t trees = 0;
+  // bytes the arena of the chart took from its memory resource
+  size_t chartBytes = 0;
+  // seconds spent on recognizing the tokens, building the forest of Earley
+  // and building the trees from it. GLR and LL1 build their trees while they
+  // recognize
+  double recognizeSeconds = 0;
+  double forestSeconds = 0;
+  double treeSeconds = 0;
+};
+
+// Receives the statistics of the parses it is passed to. Its functions are
+// called on the thread that parses, so an observer shared by parses that run
+// at the same time must be thread safe. EarleyParser reports its sets as they
+// are processed, and a parse on each finish()
+struct ParseObserver {
+  virtual ~ParseObserver() = default;
+  // whether onSet() receives the work of each set by rule
+  virtual auto profilesRules() const -> bool { return false; }
+  virtual void onSet(const SetStats &) {}
+  virtual void onParse(const ParseStats &) {}
+};
+
+// Cost of one rule, over all sets a RuleProfiler observed
+struct RuleCost {
+  // index in CompiledGrammar::rules, whose symbol and idx name the rule
+  uint32_t rule = 0;
+  size_t items = 0;
+  size_t completions = 0;
+  double seconds = 0;
+};
+
+// Observer that adds up the items, completions and time of Earley sets by
+// rule, to find the rules that a corpus spends its parses on. The time of a
+// set is split among its rules by their share of its items and completions.
+// It can be shared by parses that run at the same time
+struct RuleProfiler : ParseObserver {
+  enum Order { Items, Completions, Seconds };
+
+  explicit RuleProfiler(const CompiledGrammar &grammar);
+  ~RuleProfiler() override;
+
+  auto profilesRules() const -> bool override { return true; }
+  void onSet(const SetStats &stats) override;
+
+  // the rules with any items, the most costly by `order` first
+  auto report(Order order = Seconds) const -> std::vector<RuleCost>;
+  // writes the first `limit` rules of report(order) as a table, with the
+  // share of each of the total and the rule itself
+  void print(std::ostream &out, Order order = Seconds,
+             size_t limit = size_t(-1)) const;
+
+ private:
+  std::unique_ptr<detail::RuleProfile> profile;
+};
+
+struct ParseOptions {
+  // memoize deterministic reduction paths (Leo), so that right recursive
+  // rules complete in linear instead of quadratic time
+  bool leo = true;
+  // only predict rules that can start with the next token or derive the
+  // empty sequence
+  bool lookahead = true;
+  // threads that share the work on large state sets in Earley. The trees
+  // are the same with any number of threads
+  unsigned threads = 1;
+  // The chart of a parse is allocated from an arena of its own, which takes
+  // its memory from this resource, or the default one if null. It must be
+  // thread safe if parses that share it run at the same time
+  std::pmr::memory_resource *memory = nullptr;
+  // receives the statistics of the parse. Without one, none are collected
+  ParseObserver *observer = nullptr;
+};
+
+Expected<std::vector<Node>> parse(const Specification &spec,
+                                  const Tokens &tokens,
+                                  ParserType parserType = ParserType::Auto,
+                                  ParseOptions options = {});
+
+Expected<std::vector<Node>> parse(const CompiledGrammar &grammar,
+                                  const Tokens &tokens,
+                                  ParserType parserType = ParserType::Auto,
+                                  ParseOptions options = {});
+
+Expected<std::vector<Node>> parse(const CompiledGrammar &grammar,
+                                  const TokenStream &tokens,
+                                  ParserType parserType = ParserType::Auto,
+                                  ParseOptions options = {});
+
+// Options of parseBatch. `threads` is the number of threads to parse on, 0
+// for one per hardware thread
+struct BatchOptions {
+  ParserType parserType = ParserType::Auto;
+  ParseOptions parse = {};
+  unsigned threads = 0;
+};
+
+// Parses each of `inputs` on a pool of threads that share `grammar`, and
+// returns the results in the order of `inputs`. Each thread starts on its own
+// share of the inputs and steals from the others once it is done with it.
+//
+// Specification, Terminals, CompiledTerminals, CompiledGrammar, Generator
+// and CompiledGenerator can be read by any number of threads at once, as
+// long as none of them modifies the object. This covers compile(),
+// tokenize(), parse() and generate(), which keep no state between calls; the
+// parse tables that a CompiledGrammar builds on first use are built exactly
+// once. An EarleyParser must only be used by one thread at a time
+std::vector<Expected<std::vector<Node>>> parseBatch(
+    const CompiledGrammar &grammar, const std::vector<TokenStream> &inputs,
+    BatchOptions options = {});
+std::vector<Expected<std::vector<Node>>> parseBatch(
+    const CompiledGrammar &grammar, const std::vector<Tokens> &inputs,
+    BatchOptions options = {});
+
+// Shared packed parse forest. Every (symbol, start, end) is a single symbol
+// node, and each distinct sequence of children it can have is one of its
+// packed nodes, so shared subtrees and ambiguities are stored once
+struct Forest {
+  struct SymbolNode {
+    int symbol = 0;
+    uint32_t start = 0;
+    uint32_t end = 0;
+    uint32_t familiesBegin = 0;
+    uint32_t familiesEnd = 0;
+    bool leaf = false;
+  };
+
+  struct PackedNode {
+    uint32_t childrenBegin = 0;
+    uint32_t childrenEnd = 0;
+  };
+
+  // symbol names are looked up in the grammar, which must outlive the forest
+  const CompiledGrammar *grammar = nullptr;
+  std::vector<SymbolNode> nodes;
+  std::vector<PackedNode> families;
+  std::vector<uint32_t> children;
+  uint32_t root = 0;
+  // text of each token, empty if the forest was parsed from Tokens
+  std::vector<std::string_view> text;
+};
+
+Expected<Forest> parseForest(const CompiledGrammar &grammar,
+                             const Tokens &tokens, ParseOptions options = {});
+Expected<Forest> parseForest(const CompiledGrammar &grammar,
+                             const TokenStream &tokens,
+                             ParseOptions options = {});
+
+// Builds the distinct trees of `forest` one at a time and passes each of them
+// to `f`, until `f` returns false
+void forEachTree(const Forest &forest,
+                 const std::function<bool(const Node &)> &f);
+
+// Earley parser that is fed one token at a time and extends its chart by one
+// state set per token, so that input no sentence starts with is rejected at
+// the token that makes it so. The grammar, and the text of the tokens, must
+// outlive the parser. Predictions can not look ahead at tokens that were not
+// fed yet, so the `lookahead` option is ignored
+struct EarleyParser {
+  explicit EarleyParser(const CompiledGrammar &grammar,
+                        ParseOptions options = {});
+  EarleyParser(EarleyParser &&) noexcept;
+  auto operator=(EarleyParser &&) noexcept -> EarleyParser &;
+  ~EarleyParser();
+
+  // appends `token` to the input and returns true, or returns false and
+  // leaves the parser unchanged if no sentence starts with the longer input
+  auto feed(const Token &token) -> bool;
+  auto feed(std::string_view symbol) -> bool;
+  // parses `tokens`, which are the input so far with tokens [begin, end)
+  // replaced, again. The state sets up to `begin` are kept, and those after
+  // the edit are reused from the first one that holds the same items as
+  // before the edit on. Returns false and leaves the parser unchanged if no
+  // sentence starts with `tokens`
+  auto edit(const TokenStream &tokens, size_t begin, size_t end) -> bool;
+  // whether the input so far is a sentence
+  auto canAccept() const -> bool;
+  // the terminals that can follow the input so far
+  auto expectedNext() const -> std::vector<std::string>;
+  // the trees of the input so far
+  auto finish() const -> Expected<std::vector<Node>>;
+
+ private:
+  std::unique_ptr<detail::EarleyState> state;
+};
 
 template <typename... Ts>
 struct Ctor {};
@@ -279,19 +908,30 @@ struct NthType<0, T, Ts...> {
   using type = T;
 };
 
+// an address that identifies type T, compared in place of typeid hashes
+template <typename T>
+inline constexpr char kTypeTag = 0;
+
 struct AnnotatedPtr {
   void *ptr = nullptr;
-  size_t id = 0;
+  const void *type = nullptr;
 };
 
+struct CompiledGenerator;
+
 struct Generator {
+  // Builds objects of a bound type in the memory of a generation, which is
+  // released at once when it ends
   struct Concept {
     Concept(bool useString) : useStringToConstruct(useString) {}
 
     virtual ~Concept() = default;
-    virtual auto construct(std::vector<AnnotatedPtr> args)
+    virtual auto construct(const AnnotatedPtr *args, size_t n,
+                           std::pmr::memory_resource &memory) const
+        -> std::optional<AnnotatedPtr> = 0;
+    virtual auto construct(const std::string &expr,
+                           std::pmr::memory_resource &memory) const
         -> std::optional<AnnotatedPtr> = 0;
-    virtual auto construct(std::string expr) -> std::optional<AnnotatedPtr> = 0;
     virtual void destruct(void *obj) const = 0;
 
     bool useStringToConstruct = false;
@@ -301,57 +941,73 @@ struct Generator {
   struct Model : Concept {
     using Concept::Concept;
 
-    auto construct(std::vector<AnnotatedPtr> args)
+    auto construct(const AnnotatedPtr *args, size_t n,
+                   std::pmr::memory_resource &memory) const
         -> std::optional<AnnotatedPtr> override {
       if constexpr (CheckUseString<Ctors...>::value) {
         return std::nullopt;
       } else {
         if constexpr (sizeof...(Ctors) == 0)
-          return AnnotatedPtr{new T(), typeid(T).hash_code()};
+          return AnnotatedPtr{new (allocate(memory)) T(), &kTypeTag<T>};
         else
-          return match(args, Ctors{}...);
+          return match(args, n, memory, Ctors{}...);
       }
     }
 
-    auto construct(std::string expr) -> std::optional<AnnotatedPtr> override {
+    auto construct(const std::string &expr,
+                   std::pmr::memory_resource &memory) const
+        -> std::optional<AnnotatedPtr> override {
       if constexpr (CheckUseString<Ctors...>::value)
-        return AnnotatedPtr{new T(expr), typeid(T).hash_code()};
+        return AnnotatedPtr{new (allocate(memory)) T(expr), &kTypeTag<T>};
       else
         return std::nullopt;
     }
 
-    void destruct(void *obj) const override { delete (T *)obj; }
+    void destruct(void *obj) const override { ((T *)obj)->~T(); }
+
+    static auto allocate(std::pmr::memory_resource &memory) -> void * {
+      return memory.allocate(sizeof(T), alignof(T));
+    }
+
+    // the object of child I, to be moved into its parent. The moved from
+    // object is only destructed afterwards
+    template <int I, typename... Args>
+    static auto take(const AnnotatedPtr *args)
+        -> typename NthType<I, Args...>::type && {
+      return std::move(*(typename NthType<I, Args...>::type *)args[I].ptr);
+    }
 
     template <typename... Args, int... I>
-    static auto integerSeqHelper(std::vector<AnnotatedPtr> args,
+    static auto integerSeqHelper(const AnnotatedPtr *args,
+                                 std::pmr::memory_resource &memory,
                                  std::integer_sequence<int, I...>) {
-      return AnnotatedPtr{
-          new T((*(typename NthType<I, Args...>::type *)args[I].ptr)...),
-          typeid(T).hash_code()};
+      return AnnotatedPtr{new (allocate(memory)) T(take<I, Args...>(args)...),
+                          &kTypeTag<T>};
     }
 
     template <typename... Args, typename... Cs>
-    auto match(std::vector<AnnotatedPtr> args, Ctor<Args...>, Cs... ctors)
-        -> std::optional<AnnotatedPtr> {
-      if (int i = 0; std::size(args) == sizeof...(Args) &&
-                     ((args[i++].id == typeid(Args).hash_code()) && ...))
+    auto match(const AnnotatedPtr *args, size_t n,
+               std::pmr::memory_resource &memory, Ctor<Args...>,
+               Cs... ctors) const -> std::optional<AnnotatedPtr> {
+      if (int i = 0; n == sizeof...(Args) &&
+                     ((args[i++].type == &kTypeTag<Args>) && ...))
         return integerSeqHelper<Args...>(
-            args, std::make_integer_sequence<int, sizeof...(Args)>{});
+            args, memory, std::make_integer_sequence<int, sizeof...(Args)>{});
       if constexpr (sizeof...(Cs) == 0)
         return std::nullopt;
       else
-        return match(args, ctors...);
+        return match(args, n, memory, ctors...);
     }
   };
 
   template <typename T, typename... Ctors>
   void bind(std::string name, Ctors...) {
-    models[name] = std::make_unique<Model<T, Ctors...>>(false);
+    models[name] = std::make_shared<Model<T, Ctors...>>(false);
   }
 
   template <typename T>
   void bind(std::string name, UseString) {
-    models[name] = std::make_unique<Model<T, UseString>>(true);
+    models[name] = std::make_shared<Model<T, UseString>>(true);
   }
 
   auto findModel(std::string symbol) const -> std::optional<Concept *> {
@@ -362,17 +1018,53 @@ struct Generator {
   }
 
  private:
-  std::map<std::string, std::unique_ptr<Concept>> models;
+  friend auto compile(const Generator &generator,
+                      const CompiledGrammar &grammar) -> CompiledGenerator;
+
+  std::map<std::string, std::shared_ptr<Concept>> models;
 };
 
-Expected<std::pair<AnnotatedPtr, Generator::Concept *>> generateImpl(
-    const Generator &generator, const Node &node);
+// The models of a Generator indexed by the symbol ids of a grammar, so that
+// generating from the trees it parses looks up no names. Build it once with
+// compile() and reuse it across generate() calls
+struct CompiledGenerator {
+  auto findModel(int id) const -> const Generator::Concept * {
+    return id >= 0 && size_t(id) < size(models) ? models[id].get() : nullptr;
+  }
 
-template <typename T>
-auto generate(const Generator &generator, const Node &node) -> Expected<T> {
-  if (auto ret = generateImpl(generator, node)) {
+  std::vector<std::shared_ptr<const Generator::Concept>> models;
+};
+
+auto compile(const Generator &generator, const CompiledGrammar &grammar)
+    -> CompiledGenerator;
+
+Expected<std::pair<AnnotatedPtr, const Generator::Concept *>> generateImpl(
+    const Generator &generator, const Node &node,
+    std::pmr::memory_resource &memory);
+Expected<std::pair<AnnotatedPtr, const Generator::Concept *>> generateImpl(
+    const CompiledGenerator &generator, const Node &node,
+    std::pmr::memory_resource &memory);
+Expected<std::pair<AnnotatedPtr, const Generator::Concept *>> generateImpl(
+    const Generator &generator, const Forest &forest,
+    std::pmr::memory_resource &memory);
+Expected<std::pair<AnnotatedPtr, const Generator::Concept *>> generateImpl(
+    const CompiledGenerator &generator, const Forest &forest,
+    std::pmr::memory_resource &memory);
+
+// Builds the object of type T that `node` describes. The objects of its
+// descendants live in an arena that is released once it is built. A
+// CompiledGenerator can only build trees that carry the symbol ids of the
+// grammar it was compiled for.
+//
+// Given the Forest of an unambiguous input instead, the bindings run on its
+// only derivation as it is walked, so that no Node tree is built at all. It
+// fails if any node of the forest has more than one tree
+template <typename T, typename G, typename Tree>
+auto generate(const G &generator, const Tree &tree) -> Expected<T> {
+  std::pmr::monotonic_buffer_resource memory;
+  if (auto ret = generateImpl(generator, tree, memory)) {
     auto [arg, model] = *ret;
-    T object = *(T *)arg.ptr;
+    Expected<T> object = std::move(*(T *)arg.ptr);
     model->destruct(arg.ptr);
     return object;
   } else {
@@ -380,7 +1072,16 @@ auto generate(const Generator &generator, const Node &node) -> Expected<T> {
   }
 }
 
-auto parseSpec(std::string filename) -> Specification;
+// Parses the rules of a grammar file, one per line:
+//
+//   symbol {attributes} >= symbols       or == for an intermediate symbol
+//   symbol >= template[a -> b c, d -> ]  the rules of `template` with each a
+//                                        replaced by b c and each d removed
+//
+// with | ( ) ? * + & and {attributes} after a symbol as in a Specification,
+// \ before punctuation that is a symbol and # at the start of comments.
+// Errors are reported as "line:column: message"
+auto parseSpec(std::string_view text) -> Expected<Specification>;
 
 template <typename F>
 void forEachLine(std::string text, F f) {
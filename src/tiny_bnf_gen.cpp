@@ -0,0 +1,270 @@
+// Generates a header with the parser of a grammar file, for grammars that are
+// known when the program is built:
+//
+//   tiny_bnf_gen grammar.txt name name.h [skipped bytes]
+//
+// The header defines, in namespace `name`, the ids of the symbols, the
+// compiled grammar and a tokenizer whose automaton is compiled into switch
+// statements. The terminals are the symbols that no rule derives, plus each
+// of the skipped bytes, which separate tokens
+#include <tiny_bnf.h>
+
+#include <cctype>
+#include <fstream>
+#include <iostream>
+
+namespace bnf = tiny_bnf;
+
+namespace {
+
+auto readFile(const std::string &filename) -> bnf::Expected<std::string> {
+  std::ifstream file(filename, std::ios::binary);
+  if (!file) return bnf::Error<>("cannot read: " + filename);
+  return std::string(std::istreambuf_iterator<char>(file), {});
+}
+
+// `s` as a C++ string literal
+auto quote(std::string_view s) -> std::string {
+  std::string quoted = "\"";
+  for (auto c : s) {
+    if (c == '"' || c == '\\') quoted += '\\';
+    quoted += c;
+  }
+  return quoted + '"';
+}
+
+// `c` as a C++ character literal
+auto quoteChar(char c) -> std::string {
+  if (c == '\'' || c == '\\') return std::string("'\\") + c + "'";
+  if (uint8_t(c) < 0x20 || uint8_t(c) >= 0x7f)
+    return "char(" + std::to_string(uint8_t(c)) + ")";
+  return std::string("'") + c + "'";
+}
+
+auto boolean(bool b) { return b ? "true" : "false"; }
+
+// `inline constexpr std::array<type, n> name = {elements};`, one per line
+template <typename T, typename F>
+void array(std::ostream &out, const std::string &type, const std::string &name,
+           const std::vector<T> &v, F element) {
+  out << "inline constexpr std::array<" << type << ", " << size(v) << "> "
+      << name << " = {{\n";
+  for (const auto &x : v) out << "    " << element(x) << ",\n";
+  out << "}};\n\n";
+}
+
+void writeGrammar(std::ostream &out, const bnf::CompiledGrammar &g) {
+  using Rule = bnf::CompiledGrammar::Rule;
+  using Expr = bnf::CompiledGrammar::Expr;
+  auto number = [](auto x) { return std::to_string(x); };
+
+  array(out, "std::string_view", "kSymbols", g.symbols, quote);
+  array(out, "tiny_bnf::CompiledGrammar::Rule", "kRules", g.rules,
+        [](const Rule &r) {
+          return "tiny_bnf::CompiledGrammar::Rule{" + std::to_string(r.symbol) +
+                 ", " + std::to_string(r.exprBegin) + ", " +
+                 std::to_string(r.exprEnd) + ", " +
+                 std::to_string(r.attribsBegin) + ", " +
+                 std::to_string(r.attribsEnd) + ", " + std::to_string(r.idx) +
+                 ", " + boolean(r.intermediate) + ", " + boolean(r.alias) +
+                 ", " + boolean(r.nullable) + "}";
+        });
+  array(out, "tiny_bnf::CompiledGrammar::Expr", "kExprs", g.exprs,
+        [](const Expr &e) {
+          return "tiny_bnf::CompiledGrammar::Expr{" + std::to_string(e.symbol) +
+                 ", " + std::to_string(e.attribsBegin) + ", " +
+                 std::to_string(e.attribsEnd) + ", " + boolean(e.optional) +
+                 ", " + boolean(e.arbitrary) + ", " + boolean(e.oneOrMore) +
+                 ", " + boolean(e.deref) + "}";
+        });
+  array(out, "uint32_t", "kAlternatives", g.alternatives, number);
+  array(out, "uint32_t", "kAlternativesBegin", g.alternativesBegin, number);
+  array(out, "int", "kAttribs", g.attribs, number);
+  array(out, "std::string_view", "kAttributes", g.attributes, quote);
+  array(out, "std::pair<int, int>", "kMerges", g.merges, [](auto m) {
+    return "std::pair{" + std::to_string(m.first) + ", " +
+           std::to_string(m.second) + "}";
+  });
+  array(out, "uint32_t", "kMergesBegin", g.mergesBegin, number);
+  array(out, "uint64_t", "kFirst", g.first,
+        [](uint64_t w) { return "uint64_t(" + std::to_string(w) + "u)"; });
+  array(out, "bool", "kNullable", std::vector<bool>(g.nullable), boolean);
+
+  out << R"(// id of `symbol` in the grammar, or -1
+constexpr auto id(std::string_view symbol) -> int {
+  for (size_t s = 0; s != size(kSymbols); ++s)
+    if (kSymbols[s] == symbol) return int(s);
+  return -1;
+}
+
+// The compiled grammar, made from the arrays above on first use
+inline auto grammar() -> const tiny_bnf::CompiledGrammar & {
+  static const auto g = [] {
+    tiny_bnf::CompiledGrammar g;
+    for (size_t s = 0; s != size(kSymbols); ++s) {
+      g.symbols.emplace_back(kSymbols[s]);
+      g.ids.emplace(kSymbols[s], int(s));
+    }
+    g.rules.assign(begin(kRules), end(kRules));
+    g.exprs.assign(begin(kExprs), end(kExprs));
+    g.alternatives.assign(begin(kAlternatives), end(kAlternatives));
+    g.alternativesBegin.assign(begin(kAlternativesBegin),
+                               end(kAlternativesBegin));
+    g.attribs.assign(begin(kAttribs), end(kAttribs));
+    g.attributes.assign(begin(kAttributes), end(kAttributes));
+    g.merges.assign(begin(kMerges), end(kMerges));
+    g.mergesBegin.assign(begin(kMergesBegin), end(kMergesBegin));
+    g.first.assign(begin(kFirst), end(kFirst));
+    g.firstWords = )"
+      << g.firstWords << R"(;
+    g.nullable.assign(begin(kNullable), end(kNullable));
+    g.start = )"
+      << g.start << R"(;
+    g.tables = tiny_bnf::detail::makeTables();
+    return g;
+  }();
+  return g;
+}
+
+)";
+}
+
+// The automaton of `terminals` as switch statements over states and bytes,
+// which accept grammar ids instead of terminal indices
+void writeTokenizer(std::ostream &out, const bnf::CompiledTerminals &t,
+                    const bnf::CompiledGrammar &g) {
+  auto dead = bnf::CompiledTerminals::kDead;
+  out << R"(inline constexpr uint32_t kDead = 0xffffffff;
+// accepted by states of terminals that separate tokens
+inline constexpr int kSkipped = -2;
+
+// state of the tokenizer after `c` in state `s`
+constexpr auto next(uint32_t s, char c) -> uint32_t {
+  switch (s) {
+)";
+  auto states = size(t.accepts);
+  for (size_t s = 0; s != states; ++s) {
+    std::vector<std::string> cases;
+    for (int c = 0; c != 256; ++c) {
+      auto to = t.next(s, char(c));
+      if (to != dead)
+        cases.push_back("        case " + quoteChar(char(c)) +
+                        ": return " + std::to_string(to) + ";\n");
+    }
+    if (cases.empty()) continue;
+    out << "    case " << s << ":\n      switch (c) {\n";
+    for (const auto &c : cases) out << c;
+    out << "      }\n      break;\n";
+  }
+  out << R"(  }
+  return kDead;
+}
+
+// grammar id of the terminal that ends in state `s`, kSkipped or -1
+constexpr auto accepts(uint32_t s) -> int {
+  switch (s) {
+)";
+  for (size_t s = 0; s != states; ++s)
+    if (auto a = t.accepts[s]; a != -1) {
+      const auto &symbol = t.symbols[a];
+      out << "    case " << s << ": return "
+          << (symbol.empty() ? "kSkipped" : std::to_string(g.id(symbol)))
+          << ";\n";
+    }
+  out << R"(  }
+  return -1;
+}
+
+// tiny_bnf::tokenize(terminals, grammar(), input, delimit) on the compiled
+// automaton: the longest match at each position, with separators dropped
+inline auto tokenize(std::string_view input, bool delimit = false)
+    -> tiny_bnf::Expected<tiny_bnf::TokenStream> {
+  auto isWord = [](char c) {
+    return (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') || c == '_';
+  };
+
+  tiny_bnf::TokenStream tokens;
+  for (size_t a = 0; a != size(input);) {
+    auto word = a;
+    if (delimit && isWord(input[a]))
+      while (word != size(input) && isWord(input[word])) ++word;
+    auto boundary = [&](size_t end) {
+      return end >= word && (end == word || end == size(input) ||
+                             !isWord(input[end]) || !isWord(input[a]));
+    };
+
+    size_t end = a;
+    int accept = -1;
+    uint32_t s = 0;
+    for (auto b = a; b != size(input); ++b) {
+      s = next(s, input[b]);
+      if (s == kDead) break;
+      if (accepts(s) != -1 && (!delimit || boundary(b + 1))) {
+        end = b + 1;
+        accept = accepts(s);
+      }
+    }
+
+    if (accept == -1)
+      return tiny_bnf::Error<>("Unable to tokenize: " +
+                               std::string(input.substr(a)));
+    if (accept != kSkipped)
+      tokens.push_back({accept, input.substr(a, end - a)});
+    a = end;
+  }
+  return tokens;
+}
+
+inline auto parse(std::string_view input,
+                  tiny_bnf::ParserType parserType = tiny_bnf::ParserType::Auto,
+                  tiny_bnf::ParseOptions options = {})
+    -> tiny_bnf::Expected<std::vector<tiny_bnf::Node>> {
+  auto tokens = tokenize(input);
+  if (!tokens) return tiny_bnf::Error<>(tokens.error());
+  return tiny_bnf::parse(grammar(), *tokens, parserType, options);
+}
+
+)";
+}
+
+}  // namespace
+
+int main(int argc, char **argv) {
+  if (argc != 4 && argc != 5) {
+    std::cerr << "usage: tiny_bnf_gen grammar name output [skipped bytes]\n";
+    return 2;
+  }
+  std::string name = argv[2];
+
+  auto text = readFile(argv[1]);
+  if (!text) {
+    std::cerr << text.error() << '\n';
+    return 1;
+  }
+  auto spec = bnf::parseSpec(*text);
+  if (!spec) {
+    std::cerr << argv[1] << ':' << spec.error() << '\n';
+    return 1;
+  }
+
+  auto grammar = bnf::compile(*spec);
+  auto terminals = bnf::autoTerminals(grammar);
+  if (argc == 5)
+    for (auto c : std::string_view(argv[4])) terminals[std::string(1, c)] = "";
+
+  std::ofstream out(argv[3]);
+  auto guard = name;
+  for (auto &c : guard) c = std::isalnum(uint8_t(c)) ? std::toupper(c) : '_';
+  out << "// Generated by tiny_bnf_gen from " << argv[1]
+      << ", do not edit\n#ifndef " << guard << "_H\n#define " << guard
+      << "_H\n\n#include <tiny_bnf.h>\n\n#include <array>\n\nnamespace "
+      << name << " {\n\n";
+  writeGrammar(out, grammar);
+  writeTokenizer(out, bnf::compile(terminals), grammar);
+  out << "}  // namespace " << name << "\n\n#endif  // " << guard << "_H\n";
+
+  if (!out) {
+    std::cerr << "cannot write: " << argv[3] << '\n';
+    return 1;
+  }
+}
@@ -0,0 +1,216 @@
+#ifndef TINY_BNF_INTERNAL_H
+#define TINY_BNF_INTERNAL_H
+
+// Declarations shared by the translation units of the library, not part of
+// its interface
+
+#include <tiny_bnf.h>
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <functional>
+#include <limits>
+#include <map>
+#include <mutex>
+#include <set>
+#include <thread>
+#include <tuple>
+
+namespace tiny_bnf {
+
+constexpr uint32_t kNone = std::numeric_limits<uint32_t>::max();
+
+inline auto isWord(char c) -> bool {
+  return (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') || c == '_';
+}
+
+// index of the first byte of `s` from `i` on that is not a word byte, or not
+// one of `bytes`. Blocks of bytes are classified at once where the cpu allows
+auto scanWord(std::string_view s, size_t i) -> size_t;
+auto scanSkip(std::string_view s, size_t i, std::string_view bytes) -> size_t;
+
+// Threads that run the iterations of a loop together with the thread that
+// starts it
+struct WorkerPool {
+  explicit WorkerPool(size_t threads);
+  ~WorkerPool();
+
+  // calls f(0), ..., f(n - 1) and returns once all calls returned
+  void run(size_t n, const std::function<void(size_t)> &f);
+
+ private:
+  void work();
+
+  std::vector<std::thread> workers;
+  std::mutex mutex;
+  std::condition_variable wake, done;
+  const std::function<void(size_t)> *job = nullptr;
+  size_t n = 0;
+  std::atomic<size_t> next = 0;
+  size_t busy = 0;
+  size_t generation = 0;
+  bool stop = false;
+};
+
+// the input from the first to the last token that `nodes` span
+inline auto span(const std::vector<Node> &nodes) -> std::string_view {
+  auto spans = [](const Node &node) { return !node.text.empty(); };
+  auto first = std::find_if(begin(nodes), end(nodes), spans);
+  if (first == end(nodes)) return {};
+  auto last = std::find_if(rbegin(nodes), rend(nodes), spans);
+  return {first->text.data(),
+          size_t(last->text.data() + size(last->text) - first->text.data())};
+}
+
+// the token as it appears in error messages
+inline auto show(const CompiledGrammar &g, const Token &token) -> std::string {
+  return token.symbol != -1 ? g.symbols[token.symbol] : std::string(token.text);
+}
+
+// Interned sets of attribute ids, so that a parser state refers to the
+// attributes it has collected with a single integer
+struct AttributeSets {
+  auto intern(std::vector<int> set) -> uint32_t {
+    auto [it, inserted] = ids.insert({set, size(sets)});
+    if (inserted) sets.push_back(std::move(set));
+    return it->second;
+  }
+
+  auto contains(uint32_t set, int attribute) const {
+    return std::binary_search(begin(sets[set]), end(sets[set]), attribute);
+  }
+
+  // attributes of `dst` plus "symbol.a" for each attribute a of `ref`
+  auto merge(const CompiledGrammar &g, uint32_t dst, int symbol, uint32_t ref)
+      -> uint32_t {
+    if (g.mergesBegin[symbol] == g.mergesBegin[symbol + 1] || ref == 0)
+      return dst;
+    if (auto it = merged.find({dst, symbol, ref}); it != end(merged))
+      return it->second;
+
+    auto set = sets[dst];
+    for (auto m = g.mergesBegin[symbol]; m != g.mergesBegin[symbol + 1]; ++m)
+      if (contains(ref, g.merges[m].first)) set.push_back(g.merges[m].second);
+    std::sort(begin(set), end(set));
+    set.erase(std::unique(begin(set), end(set)), end(set));
+
+    return merged[{dst, symbol, ref}] = intern(std::move(set));
+  }
+
+  // attributes of both `a` and `b`
+  auto unite(uint32_t a, uint32_t b) -> uint32_t {
+    if (a == b || b == 0) return a;
+    if (a == 0) return b;
+    std::vector<int> set;
+    std::set_union(begin(sets[a]), end(sets[a]), begin(sets[b]), end(sets[b]),
+                   back_inserter(set));
+    return intern(std::move(set));
+  }
+
+  std::vector<std::vector<int>> sets = {{}};
+  std::map<std::vector<int>, uint32_t> ids = {{{}, 0}};
+  std::map<std::tuple<uint32_t, int, uint32_t>, uint32_t> merged;
+};
+
+// Interns the symbol nodes of a forest and collects the distinct children
+// sequences of each of them
+struct ForestWriter {
+  using Sequences = std::vector<std::vector<uint32_t>>;
+
+  auto node(int symbol, uint32_t start, uint32_t end, bool leaf) -> uint32_t {
+    auto [it, inserted] =
+        ids.insert({std::tuple{symbol, start, end}, size(forest.nodes)});
+    if (inserted) {
+      forest.nodes.push_back({symbol, start, end, 0, 0, leaf});
+      families.emplace_back();
+      known.emplace_back();
+    }
+    return it->second;
+  }
+
+  void addFamilies(uint32_t n, const Sequences &seqs) {
+    for (const auto &seq : seqs)
+      if (known[n].emplace(begin(seq), end(seq)).second)
+        families[n].push_back(seq);
+  }
+
+  // packs the collected families into the flat arrays of the forest
+  void finish() {
+    for (size_t n = 0; n != size(forest.nodes); ++n) {
+      forest.nodes[n].familiesBegin = size(forest.families);
+      for (const auto &seq : families[n]) {
+        forest.families.push_back({uint32_t(size(forest.children)), 0});
+        forest.children.insert(end(forest.children), begin(seq), end(seq));
+        forest.families.back().childrenEnd = size(forest.children);
+      }
+      forest.nodes[n].familiesEnd = size(forest.families);
+    }
+  }
+
+  // memory of the bookkeeping of a build, which is released at once with it
+  std::pmr::monotonic_buffer_resource memory = {};
+  Forest forest = {};
+  std::pmr::map<std::tuple<int, uint32_t, uint32_t>, uint32_t> ids{&memory};
+  std::vector<Sequences> families = {};
+  std::pmr::vector<std::pmr::set<std::pmr::vector<uint32_t>>> known{&memory};
+};
+
+// The grammar rewritten into plain BNF for the table driven parsers. Each
+// optional, arbitrary or oneOrMore expr is replaced by a generated symbol of
+// its own, whose nodes are always spliced into their parent and hand the
+// attributes collected by their children up unchanged
+struct Bnf {
+  struct Production {
+    int symbol = 0;
+    // rule of the grammar the production was expanded from
+    uint32_t rule = 0;
+    // the left hand side is a generated symbol
+    bool generated = false;
+    std::vector<int> rhs = {};
+    // expr of the rule each symbol of `rhs` was expanded from
+    std::vector<uint32_t> exprs = {};
+  };
+
+  auto isGenerated(int symbol) const { return symbol >= generatedBegin; }
+  auto isNonTerminal(int symbol) const {
+    return size(alternatives[symbol]) != 0;
+  }
+
+  std::vector<Production> productions;
+  // production ids by left hand side symbol
+  std::vector<std::vector<uint32_t>> alternatives;
+  std::vector<bool> nullable;
+  // symbols of the grammar keep their ids, generated ones follow them
+  int generatedBegin = 0;
+  int symbols = 0;
+};
+
+auto expand(const CompiledGrammar &g) -> Bnf;
+
+struct LrTables;
+struct LlTables;
+
+auto parseGLR(const CompiledGrammar &g, const TokenStream &tokens)
+    -> Expected<std::vector<Node>>;
+
+// whether `g` is LL(1) once rewritten, and its trees can be built by parseLL1
+auto isLL1(const CompiledGrammar &g) -> bool;
+auto parseLL1(const CompiledGrammar &g, const TokenStream &tokens)
+    -> Expected<std::vector<Node>>;
+
+namespace detail {
+
+// Parse tables that are built on first use, shared by the copies of a grammar
+struct Tables {
+  std::once_flag lrOnce;
+  std::shared_ptr<const LrTables> lr;
+  std::once_flag llOnce;
+  std::shared_ptr<const LlTables> ll;
+};
+
+}  // namespace detail
+
+}  // namespace tiny_bnf
+
+#endif  // TINY_BNF_INTERNAL_H